@@ -5,43 +5,223 @@
 #include <iostream>
 #include <string>
 #include <vector>
-#include <map>
 #include <ctime>
 #include <algorithm>
 #include <cmath>
 #include <cstdlib>
-#include <tuple>
 #include <functional>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <limits>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+// SSE есть на любом x64; без него частицы считаются по одной
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define ARKANOID_SSE
+#endif
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef ARKANOID_TRACK_ALLOCATIONS
+// Глобальный счетчик выделений памяти. Включается при сборке с
+// ARKANOID_TRACK_ALLOCATIONS, в обычной сборке operator new не подменяется.
+// Кадры проверяются по счетчику своего потока: выделения рабочих потоков
+// (предзагрузка уровня, оценка раскладок) кадру не мешают.
+std::atomic<long long> allocationCount(0);
+std::atomic<long long> allocationBytes(0);
+thread_local long long threadAllocationCount = 0;
+
+void* operator new(std::size_t size) {
+    threadAllocationCount++;
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocationBytes.fetch_add(static_cast<long long>(size), std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+#endif
+
+// Числа с фиксированной точкой: raw хранит значение, умноженное на 2^FractionBits.
+// Сложение и сравнение целочисленные, умножение и деление идут через int64_t с
+// насыщением, поэтому результат не зависит от компилятора, флагов и FMA.
+// Из float и int число строится неявно, обратно - только через toFloat.
+template <int FractionBits>
+struct FixedPoint {
+    static const int32_t ONE = int32_t(1) << FractionBits;
+    int32_t raw;
+
+    FixedPoint() = default;
+    constexpr FixedPoint(int value) : raw(value * ONE) {}
+    constexpr FixedPoint(float value) : raw(static_cast<int32_t>(value * ONE + (value < 0 ? -0.5f : 0.5f))) {}
+    constexpr FixedPoint(double value) : raw(static_cast<int32_t>(value * ONE + (value < 0 ? -0.5 : 0.5))) {}
+
+    static constexpr FixedPoint fromRaw(int32_t value) {
+        FixedPoint result = 0;
+        result.raw = value;
+        return result;
+    }
+
+    static constexpr int32_t saturate(int64_t value) {
+        return value > INT32_MAX ? INT32_MAX : value < -INT32_MAX ? -INT32_MAX : static_cast<int32_t>(value);
+    }
+
+    FixedPoint& operator+=(FixedPoint other) { return *this = *this + other; }
+    FixedPoint& operator-=(FixedPoint other) { return *this = *this - other; }
+    FixedPoint& operator*=(FixedPoint other) { return *this = *this * other; }
+    FixedPoint& operator/=(FixedPoint other) { return *this = *this / other; }
+    constexpr FixedPoint operator-() const { return fromRaw(-raw); }
+
+    friend constexpr FixedPoint operator+(FixedPoint a, FixedPoint b) { return fromRaw(saturate(int64_t(a.raw) + b.raw)); }
+    friend constexpr FixedPoint operator-(FixedPoint a, FixedPoint b) { return fromRaw(saturate(int64_t(a.raw) - b.raw)); }
+    friend constexpr FixedPoint operator*(FixedPoint a, FixedPoint b) {
+        return fromRaw(saturate((int64_t(a.raw) * b.raw) >> FractionBits));
+    }
+    // Делитель не равен нулю: вызывающий проверяет это сам, как и для float
+    friend constexpr FixedPoint operator/(FixedPoint a, FixedPoint b) {
+        return fromRaw(saturate(int64_t(a.raw) * ONE / b.raw));
+    }
+    friend constexpr bool operator==(FixedPoint a, FixedPoint b) { return a.raw == b.raw; }
+    friend constexpr bool operator!=(FixedPoint a, FixedPoint b) { return a.raw != b.raw; }
+    friend constexpr bool operator<(FixedPoint a, FixedPoint b) { return a.raw < b.raw; }
+    friend constexpr bool operator<=(FixedPoint a, FixedPoint b) { return a.raw <= b.raw; }
+    friend constexpr bool operator>(FixedPoint a, FixedPoint b) { return a.raw > b.raw; }
+    friend constexpr bool operator>=(FixedPoint a, FixedPoint b) { return a.raw >= b.raw; }
+};
+
+template <int FractionBits>
+constexpr float toFloat(FixedPoint<FractionBits> value) {
+    return static_cast<float>(value.raw) / FixedPoint<FractionBits>::ONE;
+}
+
+template <int FractionBits>
+constexpr FixedPoint<FractionBits> realAbs(FixedPoint<FractionBits> value) {
+    return value.raw < 0 ? -value : value;
+}
+
+template <int FractionBits>
+constexpr int floorToInt(FixedPoint<FractionBits> value) {
+    return value.raw >> FractionBits;
+}
+
+constexpr float toFloat(float value) {
+    return value;
+}
+
+// Биты значения для хэша состояния
+template <int FractionBits>
+uint32_t realBits(FixedPoint<FractionBits> value) {
+    return static_cast<uint32_t>(value.raw);
+}
+
+inline uint32_t realBits(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline float realAbs(float value) {
+    return std::abs(value);
+}
+
+inline int floorToInt(float value) {
+    return static_cast<int>(std::floor(value));
+}
+
+// Числовой тип состояния симуляции и расчета столкновений. Сборка с
+// ARKANOID_FIXED_POINT дает побитно одинаковые результаты на любых машинах и
+// компиляторах (Q16.16: координаты до 32767, шаг 1/65536).
+#ifdef ARKANOID_FIXED_POINT
+typedef FixedPoint<16> Real;
+
+// Значение больше любого времени и расстояния на поле
+inline Real realInfinity() {
+    return Real::fromRaw(INT32_MAX);
+}
+#else
+typedef float Real;
+
+inline Real realInfinity() {
+    return std::numeric_limits<float>::infinity();
+}
+#endif
+
+// Генератор случайных чисел игры (xorshift32). std::rand на разных CRT дает
+// разные последовательности, а уровни и выпадение бонусов должны повторяться.
+// Как и остальное состояние игры, у каждого потока свой.
+thread_local uint32_t gameRandomState = 2463534242u;
+
+void seedGameRandom(uint32_t seed) {
+    gameRandomState = seed != 0 ? seed : 2463534242u;
+}
+
+// Число из [0, 2^31), как у std::rand с RAND_MAX = 2^31 - 1
+int gameRandom() {
+    gameRandomState ^= gameRandomState << 13;
+    gameRandomState ^= gameRandomState >> 17;
+    gameRandomState ^= gameRandomState << 5;
+    return static_cast<int>(gameRandomState >> 1);
+}
 
 // Window dimensions
 const GLint WIDTH = 800, HEIGHT = 600;
 
 // Paddle
 struct Paddle {
-    float x, y;
-    float width, height;
-    float speed;
-} paddle;
+    Real x, y;
+    Real width, height;
+    Real speed;
+};
 
 // Ball
 struct Ball {
-    float x, y;
-    float radius;
-    float velocityX, velocityY;
+    Real x, y;
+    Real radius;
+    Real velocityX, velocityY;
+};
 
-    bool operator==(const Ball& other) const {
-        return x == other.x && y == other.y;
-    }
-} ball;
+// Состояние игры хранится в thread_local глобальных переменных: главный поток
+// играет, а оценщик уровней (estimateLayout) одновременно ведет свои партии без
+// окна в рабочих потоках, каждая со своими платформой, шариками и полем.
+thread_local Paddle paddle;
 
-// Типы блоков в игре Арканоид
-enum BlockType {
+// Типы блоков в игре Арканоид. Значения - индексы в реестре типов, первые три
+// типа в types.cfg обязаны идти в этом порядке, остальные добавляются файлом.
+enum BlockType : uint8_t {
     INDESTRUCTIBLE,
     DESTRUCTIBLE,
     SPEED_UP,
 };
 
-enum BonusType {
+enum BonusType : uint8_t {
     BONUS_SIZE_UP,
     BONUS_SIZE_DOWN,
     BONUS_SPEED_UP,
@@ -52,466 +232,3440 @@ enum BonusType {
     BONUS_ONE_TIME_BOTTOM
 };
 
-std::map<BlockType, std::tuple<float, float, float>> blockColorMap = {
-    {INDESTRUCTIBLE, {0.8f, 0.8f, 0.8f}}, // FFFFFF Неразрушаемые
-    {DESTRUCTIBLE, {1.0f, 0.843f, 0.0f}}, // C492B1 Блоки имеют уровень здоровья
-    {SPEED_UP, {0.886f, 0.286f, 0.427f}}  // E34A6F скорость
+// Действие бонуса при поимке
+enum BonusEffect {
+    EFFECT_PADDLE_WIDTH, // ширина платформы *= value
+    EFFECT_BALL_SPEED, // скорость шариков *= value
+    EFFECT_STICKY,
+    EFFECT_EXTRA_LIFE, // lives += value
+    EFFECT_EXTRA_BALL,
+    EFFECT_BOTTOM_SHIELD, // одноразовое дно
+    NUM_BONUS_EFFECTS
 };
 
-std::map<BonusType, std::tuple<float, float, float>> bonusColorMap = {
-    {BONUS_SIZE_UP, {0.329f, 1.0f, 0.267f}}, // 53FF45 зеленый
-    {BONUS_SIZE_DOWN, {0.329f, 1.0f, 0.267f}}, // 53FF45
-    {BONUS_STICKY, {0.329f, 1.0f, 0.267f}}, // 53FF45
-    {BONUS_EXTRA_LIFE, {0.329f, 1.0f, 0.267f}}, // 53FF45
-    {BONUS_EXTRA_BALL, {0.0f, 0.663f, 0.910f}}, // 00A9E8
-    {BONUS_SPEED_UP, {0.886f, 0.286f, 0.427f}}, // E34A6F скорость
-    {BONUS_SPEED_DOWN, {0.886f, 0.286f, 0.427f}}, // E34A6F скорость
-    {BONUS_ONE_TIME_BOTTOM, {1.0f, 0.843f, 0.0f}}  // C492B1
+// Значок бонуса, индекс в bonusGlyphFuncs
+enum BonusGlyph {
+    GLYPH_PLUS,
+    GLYPH_MINUS,
+    GLYPH_HEART,
+    GLYPH_CIRCLE,
+    GLYPH_SQUARE,
+    NUM_BONUS_GLYPHS
 };
 
-std::map<BlockType, std::vector<int>> blockHealth = {
-    {INDESTRUCTIBLE, {-1}},
-    {DESTRUCTIBLE, {1, 2}}, // Здесь мы указываем возможные значения здоровья для разрушаемых блоков
-    {SPEED_UP, {1}}
-};
+// Тип блока хранится в клетке сетки в тетраде, поэтому типов не больше 16.
+// Здоровье неразрушаемого блока (-1) хранится в клетке как 0x0F.
+const int MAX_BLOCK_TYPES = 16;
+const int CELL_HEALTH_INFINITE = 0x0F;
+const int MAX_BONUS_TYPES = 32;
+const int MAX_HEALTH_OPTIONS = 4;
 
-struct Block {
-    float x, y;
-    float width, height;
-    BlockType type;
-    int health;
-    bool destroyed;
+struct BlockTypeInfo {
+    float color[3];
+    bool indestructible;
+    int healthOptions[MAX_HEALTH_OPTIONS]; // Возможные значения здоровья нового блока
+    int numHealthOptions;
+    float ballSpeedFactor; // Множитель скорости всех шариков при ударе
+    int bonusDropChance; // Шанс выпадения бонуса при ударе, %
 };
 
-struct Bonus {
-    float x, y;
-    float width, height;
-    BonusType type;
-    bool active;
+struct BonusTypeInfo {
+    float color[3];
+    BonusGlyph glyph;
+    BonusEffect effect;
+    float effectValue;
+    int dropWeight; // Относительная частота выпадения
+    float duration; // Срок действия, с; 0 - навсегда
 };
 
-// Game state
-int score;
-int lives;
-int stickyWait;
-bool stickyBall;
-bool oneTimeBottom = false;
-bool startFlag;
-std::vector<Block> blocks;
-std::vector<Ball> balls;
-std::vector<Bonus> bonuses;
-
-bool isBoardCleared() {
-    for (const auto& block : blocks) {
-        if (!block.destroyed && block.type != INDESTRUCTIBLE)
-            return false;
-    }
-    return true;
+// Реестр типов блоков и бонусов: плотные массивы по индексу типа, так что
+// любой поиск свойства - одно чтение по индексу. Заполняется из types.cfg при
+// запуске, без файла остаются встроенные значения.
+struct TypeRegistry {
+    BlockTypeInfo blockTypes[MAX_BLOCK_TYPES];
+    int numBlockTypes;
+    BonusTypeInfo bonusTypes[MAX_BONUS_TYPES];
+    int numBonusTypes;
+    int totalDropWeight;
 };
 
-bool checkCollision(Ball& ball, Paddle& paddle) {
-    return ball.x + ball.radius >= paddle.x && ball.x - ball.radius <= paddle.x + paddle.width &&
-        ball.y + ball.radius >= paddle.y && ball.y - ball.radius <= paddle.y + paddle.height;
-}
+TypeRegistry makeDefaultTypeRegistry() {
+    TypeRegistry registry = {};
+    registry.blockTypes[INDESTRUCTIBLE] = { {0.8f, 0.8f, 0.8f}, true, {-1}, 1, 1.0f, 0 }; // FFFFFF Неразрушаемые
+    registry.blockTypes[DESTRUCTIBLE] = { {1.0f, 0.843f, 0.0f}, false, {1, 2}, 2, 1.0f, 37 }; // C492B1 Блоки имеют уровень здоровья
+    registry.blockTypes[SPEED_UP] = { {0.886f, 0.286f, 0.427f}, false, {1}, 1, 1.2f, 0 }; // E34A6F скорость
+    registry.numBlockTypes = 3;
 
-bool checkCollision(Ball& ball, Block& block) {
-    return !block.destroyed &&
-        ball.x + ball.radius > block.x && ball.x - ball.radius < block.x + block.width &&
-        ball.y + ball.radius > block.y && ball.y - ball.radius < block.y + block.height;
+    registry.bonusTypes[BONUS_SIZE_UP] = { {0.329f, 1.0f, 0.267f}, GLYPH_PLUS, EFFECT_PADDLE_WIDTH, 1.2f, 1, 20.0f }; // 53FF45 зеленый
+    registry.bonusTypes[BONUS_SIZE_DOWN] = { {0.329f, 1.0f, 0.267f}, GLYPH_MINUS, EFFECT_PADDLE_WIDTH, 0.8f, 1, 20.0f }; // 53FF45
+    registry.bonusTypes[BONUS_SPEED_UP] = { {0.886f, 0.286f, 0.427f}, GLYPH_PLUS, EFFECT_BALL_SPEED, 1.2f, 1, 15.0f }; // E34A6F скорость
+    registry.bonusTypes[BONUS_SPEED_DOWN] = { {0.886f, 0.286f, 0.427f}, GLYPH_MINUS, EFFECT_BALL_SPEED, 0.8f, 1, 15.0f }; // E34A6F скорость
+    registry.bonusTypes[BONUS_STICKY] = { {0.329f, 1.0f, 0.267f}, GLYPH_SQUARE, EFFECT_STICKY, 0.0f, 1, 15.0f }; // 53FF45
+    registry.bonusTypes[BONUS_EXTRA_LIFE] = { {0.329f, 1.0f, 0.267f}, GLYPH_HEART, EFFECT_EXTRA_LIFE, 1.0f, 1, 0.0f }; // 53FF45
+    registry.bonusTypes[BONUS_EXTRA_BALL] = { {0.0f, 0.663f, 0.910f}, GLYPH_CIRCLE, EFFECT_EXTRA_BALL, 0.0f, 1, 0.0f }; // 00A9E8
+    registry.bonusTypes[BONUS_ONE_TIME_BOTTOM] = { {1.0f, 0.843f, 0.0f}, GLYPH_HEART, EFFECT_BOTTOM_SHIELD, 0.0f, 1, 30.0f }; // C492B1
+    registry.numBonusTypes = 8;
+    registry.totalDropWeight = 8;
+    return registry;
 }
 
-bool checkCollision(Paddle& paddle, Bonus& bonus) {
-    return bonus.active &&
-        paddle.x < bonus.x + bonus.width && paddle.x + paddle.width > bonus.x &&
-        paddle.y < bonus.y + bonus.height && paddle.y + paddle.height > bonus.y;
+TypeRegistry typeRegistry = makeDefaultTypeRegistry();
+
+// Индекс имени в списке names, -1 если не найдено
+int findName(const std::string& name, const char* const* names, int count) {
+    for (int i = 0; i < count; i++) {
+        if (name == names[i])
+            return i;
+    }
+    return -1;
 }
 
-void applyBonus(BonusType type) {
-    switch (type) {
-    case BONUS_SIZE_UP:
-        paddle.width *= 1.2f;
-        break;
-    case BONUS_SIZE_DOWN:
-        paddle.width *= 0.8f;
-        break;
-    case BONUS_SPEED_UP:
-        for (auto& ball : balls) {
-            ball.velocityX *= 1.2f;
-            ball.velocityY *= 1.2f;
+// Формат строк types.cfg (порядок строк задает индексы типов, # - комментарий):
+//   block <имя> <r> <g> <b> <здоровье через запятую или -1> <множитель скорости> <шанс бонуса %>
+//   bonus <имя> <r> <g> <b> <значок> <действие> <параметр> <вес выпадения> [<срок, с>]
+// Имена уникальны, первые три блока - indestructible, destructible и speed_up
+// (индексы BlockType). При любой ошибке в файле остаются встроенные типы.
+bool loadTypeRegistry(const char* path) {
+    static const char* const glyphNames[NUM_BONUS_GLYPHS] = { "plus", "minus", "heart", "circle", "square" };
+    static const char* const effectNames[NUM_BONUS_EFFECTS] = {
+        "paddle_width", "ball_speed", "sticky", "extra_life", "extra_ball", "bottom_shield" };
+    static const char* const builtinBlockNames[SPEED_UP + 1] = { "indestructible", "destructible", "speed_up" };
+
+    std::ifstream file(path);
+    if (!file)
+        return false;
+
+    TypeRegistry registry = {};
+    std::vector<std::string> blockNames, bonusNames;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        std::istringstream in(line);
+        std::string kind, name;
+        if (!(in >> kind) || kind[0] == '#')
+            continue;
+
+        bool ok = false;
+        if (kind == "block" && registry.numBlockTypes < MAX_BLOCK_TYPES) {
+            BlockTypeInfo& info = registry.blockTypes[registry.numBlockTypes];
+            std::string health;
+            ok = static_cast<bool>(in >> name >> info.color[0] >> info.color[1] >> info.color[2] >> health
+                >> info.ballSpeedFactor >> info.bonusDropChance);
+            info.indestructible = health == "-1";
+            std::istringstream healthIn(health);
+            std::string option;
+            while (ok && std::getline(healthIn, option, ',')) {
+                int value = std::atoi(option.c_str());
+                ok = info.numHealthOptions < MAX_HEALTH_OPTIONS && (info.indestructible || (value >= 1 && value < CELL_HEALTH_INFINITE));
+                if (ok)
+                    info.healthOptions[info.numHealthOptions++] = value;
+            }
+            ok = ok && info.numHealthOptions > 0 && info.ballSpeedFactor > 0.0f &&
+                info.bonusDropChance >= 0 && info.bonusDropChance <= 100;
+            const int index = registry.numBlockTypes;
+            if (ok && index <= SPEED_UP && (name != builtinBlockNames[index] || info.indestructible != (index == INDESTRUCTIBLE))) {
+                std::cerr << path << ":" << lineNumber << ": block type " << index << " must be " << builtinBlockNames[index] << std::endl;
+                return false;
+            }
+            ok = ok && std::find(blockNames.begin(), blockNames.end(), name) == blockNames.end();
+            blockNames.push_back(name);
+            registry.numBlockTypes++;
         }
-        break;
-    case BONUS_SPEED_DOWN:
-        for (auto& ball : balls) {
-            ball.velocityX *= 0.8f;
-            ball.velocityY *= 0.8f;
+        else if (kind == "bonus" && registry.numBonusTypes < MAX_BONUS_TYPES) {
+            BonusTypeInfo& info = registry.bonusTypes[registry.numBonusTypes];
+            std::string glyph, effect;
+            ok = static_cast<bool>(in >> name >> info.color[0] >> info.color[1] >> info.color[2] >> glyph >> effect
+                >> info.effectValue >> info.dropWeight);
+            int glyphIndex = findName(glyph, glyphNames, NUM_BONUS_GLYPHS);
+            int effectIndex = findName(effect, effectNames, NUM_BONUS_EFFECTS);
+            // Срок необязателен, без него эффект постоянный
+            if (ok && !(in >> info.duration))
+                info.duration = 0.0f;
+            ok = ok && glyphIndex >= 0 && effectIndex >= 0 && info.dropWeight >= 0 && info.duration >= 0.0f;
+            // Ширина платформы и скорость шариков умножаются на параметр
+            const bool multiplier = effectIndex == EFFECT_PADDLE_WIDTH || effectIndex == EFFECT_BALL_SPEED;
+            ok = ok && (multiplier ? info.effectValue > 0.0f : info.effectValue >= 0.0f);
+            ok = ok && std::find(bonusNames.begin(), bonusNames.end(), name) == bonusNames.end();
+            bonusNames.push_back(name);
+            info.glyph = static_cast<BonusGlyph>(glyphIndex);
+            info.effect = static_cast<BonusEffect>(effectIndex);
+            registry.totalDropWeight += info.dropWeight;
+            registry.numBonusTypes++;
         }
-        break;
-    case BONUS_STICKY:
-        stickyBall = true;
-        break;
-    case BONUS_EXTRA_LIFE:
-        lives++;
-        break;
-    case BONUS_EXTRA_BALL: {
-        if (!balls.empty()) {
-            stickyWait = 0;
-            stickyBall = false;
-            Ball newBall = { paddle.x + paddle.width / 2, paddle.y - 10.0f, 10.0f, 200.0f, -200.0f };
-            balls.push_back(newBall);
-            break;
+
+        if (!ok) {
+            std::cerr << path << ":" << lineNumber << ": invalid type definition" << std::endl;
+            return false;
         }
     }
-    case BONUS_ONE_TIME_BOTTOM:
-        oneTimeBottom = true;
-        break;
-    default:
-        break;
+
+    if (registry.numBlockTypes <= SPEED_UP || registry.totalDropWeight <= 0) {
+        std::cerr << path << ": expected at least 3 block types and a bonus with non-zero weight" << std::endl;
+        return false;
     }
+    typeRegistry = registry;
+    return true;
 }
 
-void generateSymmetricField(int numRows);
-void generatePatternedField(int numRows);
-void generateStripedField(int numRows);
+const BlockTypeInfo& blockTypeInfo(int type) {
+    return typeRegistry.blockTypes[type];
+}
 
-void initGame() {
-    std::srand(std::time(nullptr));
+const BonusTypeInfo& bonusTypeInfo(int type) {
+    return typeRegistry.bonusTypes[type];
+}
 
-    score = 0;
-    lives = 3;
-    startFlag = true;
-    stickyBall = true;
+// Случайный тип бонуса с учетом весов выпадения
+BonusType randomBonusType() {
+    int roll = gameRandom() % typeRegistry.totalDropWeight;
+    int type = 0;
+    while (roll >= typeRegistry.bonusTypes[type].dropWeight) {
+        roll -= typeRegistry.bonusTypes[type].dropWeight;
+        type++;
+    }
+    return static_cast<BonusType>(type);
+}
 
-    paddle.x = WIDTH / 2.0f - 50.0f;
-    paddle.y = HEIGHT - 30.0f;
-    paddle.width = 100.0f;
-    paddle.height = 20.0f;
-    paddle.speed = 500.0f;
+struct Block {
+    Real x, y;
+    Real width, height;
+    BlockType type;
+    int health;
+    bool destroyed;
+};
 
-    balls.clear();
-    Ball initialBall = { paddle.x + paddle.width / 2, paddle.y - 10.0f, 10.0f, 0.0f, 0.0f };
-    balls.push_back(initialBall);
+// Геометрия сетки блоков: положение блока однозначно задается строкой и столбцом
+const Real BLOCK_STEP_X = 80.0f, BLOCK_STEP_Y = 30.0f;
+const Real BLOCK_WIDTH = 78.0f, BLOCK_HEIGHT = 28.0f;
 
-    blocks.clear();
+// Номер младшего установленного бита (word != 0)
+inline int countTrailingZeros(uint64_t word) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(word);
+#endif
+}
 
-    int numRows = 4 + std::rand() % 7;
-    int generationType = std::rand() % 3;
-    switch (generationType) {
-    case 0:
-        generateSymmetricField(numRows);
-        break;
-    case 1:
-        generatePatternedField(numRows);
-        break;
-    case 2:
-        generateStripedField(numRows);
-        break;
+inline int popCount(uint64_t word) {
+#ifdef _MSC_VER
+    return static_cast<int>(__popcnt64(word));
+#else
+    return __builtin_popcountll(word);
+#endif
+}
+
+// Вызывает visit(i) для каждого установленного бита с номером из [begin, end)
+template <typename Visitor>
+void forEachSetBit(const uint64_t* words, int begin, int end, Visitor visit) {
+    for (int w = begin / 64; w * 64 < end; w++) {
+        uint64_t word = words[w];
+        if (w == begin / 64)
+            word &= ~uint64_t(0) << (begin % 64);
+        if (end - w * 64 < 64)
+            word &= (uint64_t(1) << (end - w * 64)) - 1;
+        while (word) {
+            visit(w * 64 + countTrailingZeros(word));
+            word &= word - 1;
+        }
     }
 }
 
-void addBlock(int i, int j, int randomTypeIndex) {
-    Block block;
-    block.x = j * 80.0f;
-    block.y = i * 30.0f;
-    block.width = 78.0f;
-    block.height = 28.0f;
-    block.destroyed = false;
-    auto it = blockHealth.begin();
-    std::advance(it, randomTypeIndex);
-    block.type = it->first;
-    block.health = it->second[std::rand() % it->second.size()];
-    blocks.push_back(block);
-}
-
-void generateSymmetricField(int numRows) {
-    for (int i = 0; i < numRows; ++i) {
-        for (int j = 0; j < 5; ++j) {
-            if (std::rand() % 100 < 60) {
-                addBlock(i, j, 1);
-                addBlock(i, 10 - j - 1, 1);
-            }
-            else if (std::rand() % 100 < 74) {
-                addBlock(i, j, 2);
-                addBlock(i, 10 - j - 1, 2);
-            }
-            else {
-                addBlock(i, j, 0);
-                addBlock(i, 10 - j - 1, 0);
-            }
+// Арена уровня: один буфер, из которого берется вся память уровня (сетка блоков,
+// пул бонусов, рабочие буферы генераторов). Память не освобождается по частям,
+// новый уровень просто сбрасывает указатель в начало.
+struct LevelArena {
+    std::unique_ptr<unsigned char[]> buffer;
+    size_t capacity = 0;
+    size_t used = 0;
+
+    // Кучу арена трогает только здесь и только если уровню нужно больше памяти,
+    // чем когда-либо раньше
+    void reset(size_t requiredBytes) {
+        if (requiredBytes > capacity) {
+            buffer.reset(new unsigned char[requiredBytes]);
+            capacity = requiredBytes;
         }
+        used = 0;
+    }
+
+    // Только для типов без конструкторов: память не инициализируется
+    template <typename T>
+    T* allocate(size_t count) {
+        size_t offset = (used + alignof(T) - 1) & ~(alignof(T) - 1);
+        if (offset + count * sizeof(T) > capacity)
+            throw std::bad_alloc();
+        used = offset + count * sizeof(T);
+        return reinterpret_cast<T*>(buffer.get() + offset);
+    }
+
+    // Размер allocate<T>(count) с запасом на выравнивание
+    template <typename T>
+    static size_t bytesFor(size_t count) {
+        return count * sizeof(T) + alignof(T);
     }
+};
+
+// Перемешивание splitmix64: из него строятся ключи Зобриста и хэш состояния
+inline uint64_t mixHash(uint64_t value) {
+    value += 0x9E3779B97F4A7C15ull;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+    return value ^ (value >> 31);
 }
 
+// Ключ Зобриста живой клетки с данным байтом (тип и здоровье). Ключи не хранятся
+// таблицей, а вычисляются, поэтому подходят для поля любого размера.
+inline uint64_t cellHashKey(int cell, uint8_t value) {
+    return mixHash((static_cast<uint64_t>(cell) << 8) | value);
+}
 
-void generatePatternedField(int numRows) {
-    std::vector<int> previousRow(10, 0); // 0 - пробиваемый блок, 1 - непробиваемый блок
+// Первое касание блока на пути шарика: доля пути и ось отскока
+struct BlockHit {
+    Real t;
+    int row, col;
+    bool flipX, flipY;
+    Real pushX, pushY; // Выталкивание шарика, начавшего путь внутри блока
+};
 
-    std::srand(static_cast<unsigned>(std::time(nullptr))); // Инициализация генератора случайных чисел
+// Поле блоков в упакованном виде: один байт на клетку (тип в старшей тетраде,
+// здоровье в младшей) и битовая маска живых клеток. Вместо 28 байт на Block
+// клетка занимает байт и бит.
+//
+// Поле хранится чанками 64 x 64 клетки: строка чанка в масках - одно 64-битное
+// слово, байты клеток чанка (4 КБ) лежат подряд. Над масками два уровня сводок:
+// по слову на чанк с битами строк, где есть живой (aliveRows) или разрушаемый
+// (breakableRows) блок, и по биту на чанк (aliveChunks, breakableChunks). Обходы
+// поля идут по установленным битам и пропускают пустые чанки, строки и клетки
+// целиком, поэтому запрос по окну или по пути шарика на огромном поле трогает
+// только чанки рядом с ним.
+//
+// Строки хранятся по кругу: строка row лежит в памяти под номером
+// physicalRow(row). Так поле бесконечного режима сдвигается вниз (scrollDown)
+// без копирования клеток. Маски, cells и ключи хэша используют номера в памяти,
+// все методы принимают и отдают обычные номера строк.
+const int GRID_CHUNK_SIZE = 64;
 
-    for (int i = 0; i < numRows; ++i) {
-        std::vector<int> currentRow(10, 0); // Текущая строка
+struct BlockGrid {
+    // Журнал последних изменений живых клеток (номер клетки row * cols + col).
+    // По нему кэши путей шариков проверяют, не изменилось ли поле на их пути.
+    static const int CHANGE_LOG_SIZE = 64;
 
-        for (int j = 0; j < 10; ++j) {
-            // Проверяем условия для создания коридоров
-            if (previousRow[j] == 0) {
-                if (j < 9 && previousRow[j + 1] == 0) {
-                    // Есть проход и на текущей и на следующей позиции
-                    currentRow[j] = (std::rand() % 2 == 0) ? 0 : 1;
-                }
-                else if (j > 0 && previousRow[j - 1] == 0 && currentRow[j - 1] == 0) {
-                    // Есть проход на текущей и предыдущей позиции
-                    currentRow[j] = (std::rand() % 2 == 0) ? 0 : 1;
-                }
-                else {
-                    // Иначе, делаем текущую позицию пробиваемой
-                    currentRow[j] = 0;
-                }
-            }
-            else {
-                // Ставим случайный блок, если на предыдущем ряду здесь непробиваемый блок
-                currentRow[j] = (std::rand() % 2 == 0) ? 0 : 1;
-            }
+    int rows = 0, cols = 0;
+    int chunkRows = 0, chunkCols = 0;
+    int rowOffset = 0; // Номер в памяти строки 0
+    uint8_t* cells = nullptr;         // GRID_CHUNK_SIZE * GRID_CHUNK_SIZE на чанк
+    uint64_t* alive = nullptr;        // GRID_CHUNK_SIZE слов на чанк
+    uint64_t* breakable = nullptr;
+    uint64_t* aliveRows = nullptr;    // Слово на чанк
+    uint64_t* breakableRows = nullptr;
+    uint64_t* aliveChunks = nullptr;  // Бит на чанк
+    uint64_t* breakableChunks = nullptr;
+    uint32_t revision = 0; // Число изменений живых клеток
+    uint64_t hash = 0;     // XOR ключей Зобриста живых клеток, обновляется в set и setAlive
+    int changeLog[CHANGE_LOG_SIZE];
 
-            // Добавляем блок в поле
-            if (currentRow[j] == 0) {
-                if (std::rand() % 100 < 60) {
-                    addBlock(i, j, 1);
-                }
-                else {
-                    addBlock(i, j, 2);
-                }
-            }
-            else {
-                addBlock(i, j, 0); // Непробиваемый блок
-            }
-        }
+    static size_t arenaBytes(int numRows, int numCols) {
+        const size_t chunks = static_cast<size_t>((numRows + GRID_CHUNK_SIZE - 1) / GRID_CHUNK_SIZE) * ((numCols + GRID_CHUNK_SIZE - 1) / GRID_CHUNK_SIZE);
+        return LevelArena::bytesFor<uint8_t>(chunks * GRID_CHUNK_SIZE * GRID_CHUNK_SIZE) +
+            2 * LevelArena::bytesFor<uint64_t>(chunks * GRID_CHUNK_SIZE) + 2 * LevelArena::bytesFor<uint64_t>(chunks) +
+            2 * LevelArena::bytesFor<uint64_t>((chunks + 63) / 64);
+    }
 
-        previousRow = currentRow; // Обновляем предыдущую строку
+    // Пустая сетка в памяти арены уровня
+    void reset(int numRows, int numCols, LevelArena& arena) {
+        rows = numRows;
+        cols = numCols;
+        chunkRows = (numRows + GRID_CHUNK_SIZE - 1) / GRID_CHUNK_SIZE;
+        chunkCols = (numCols + GRID_CHUNK_SIZE - 1) / GRID_CHUNK_SIZE;
+        const size_t chunks = static_cast<size_t>(chunkRows) * chunkCols;
+        const size_t summaryWords = (chunks + 63) / 64;
+        cells = arena.allocate<uint8_t>(chunks * GRID_CHUNK_SIZE * GRID_CHUNK_SIZE);
+        alive = arena.allocate<uint64_t>(chunks * GRID_CHUNK_SIZE);
+        breakable = arena.allocate<uint64_t>(chunks * GRID_CHUNK_SIZE);
+        aliveRows = arena.allocate<uint64_t>(chunks);
+        breakableRows = arena.allocate<uint64_t>(chunks);
+        aliveChunks = arena.allocate<uint64_t>(summaryWords);
+        breakableChunks = arena.allocate<uint64_t>(summaryWords);
+        std::memset(cells, 0, chunks * GRID_CHUNK_SIZE * GRID_CHUNK_SIZE);
+        std::memset(alive, 0, chunks * GRID_CHUNK_SIZE * sizeof(uint64_t));
+        std::memset(breakable, 0, chunks * GRID_CHUNK_SIZE * sizeof(uint64_t));
+        std::memset(aliveRows, 0, chunks * sizeof(uint64_t));
+        std::memset(breakableRows, 0, chunks * sizeof(uint64_t));
+        std::memset(aliveChunks, 0, summaryWords * sizeof(uint64_t));
+        std::memset(breakableChunks, 0, summaryWords * sizeof(uint64_t));
+        rowOffset = 0;
+        // Новое поле: журнал для всех, кто помнит старую ревизию, переполнен
+        revision += CHANGE_LOG_SIZE;
+        hash = 0;
     }
-}
 
-void generateStripedField(int numRows) {
-    for (int i = 0; i < numRows; ++i) {
-        for (int j = 0; j < 10; ++j) {
-            if (i % 2 == 0 && j % 2 == 0) {
-                addBlock(i, j, 0);
-            }
-            else {
-                if (std::rand() % 100 < 60) {
-                    addBlock(i, j, 1);
-                }
-                else {
-                    addBlock(i, j, 2);
-                }
-            }
-        }
+    int physicalRow(int row) const {
+        const int stored = row + rowOffset;
+        return stored < rows ? stored : stored - rows;
     }
-}
 
-void processInput(GLFWwindow* window, float deltaTime) {
-    float deltaX = paddle.x;
-    if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
-        paddle.x -= paddle.speed * deltaTime;
-    if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
-        paddle.x += paddle.speed * deltaTime;
+    // Чанк, слово маски (строка чанка) и байт клетки по строке в памяти
+    int chunkIndex(int stored, int col) const {
+        return (stored / GRID_CHUNK_SIZE) * chunkCols + col / GRID_CHUNK_SIZE;
+    }
 
-    // Mouse control
-    double mouseX, mouseY;
-    glfwGetCursorPos(window, &mouseX, &mouseY);
-    paddle.x = static_cast<float>(mouseX) - paddle.width / 2.0f;
+    int wordIndex(int stored, int col) const {
+        return chunkIndex(stored, col) * GRID_CHUNK_SIZE + stored % GRID_CHUNK_SIZE;
+    }
 
-    // Ensure the paddle stays within bounds
-    if (paddle.x < 0.0f) paddle.x = 0.0f;
-    if (paddle.x + paddle.width > WIDTH) paddle.x = WIDTH - paddle.width;
+    int cellIndex(int stored, int col) const {
+        return wordIndex(stored, col) * GRID_CHUNK_SIZE + col % GRID_CHUNK_SIZE;
+    }
 
-    deltaX -= paddle.x;
-    if (stickyBall) {
-        for (auto& ball : balls) {
-            if (startFlag || stickyWait > 0) {
-                if (ball.y - ball.radius <= paddle.y + paddle.height)
-                    ball.x -= deltaX;
-            }
-        }
+    bool isAlive(int row, int col) const {
+        return (alive[wordIndex(physicalRow(row), col)] >> (col % GRID_CHUNK_SIZE)) & 1;
     }
 
-    // Launch the ball
-    if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS && stickyBall) {
-        for (auto& ball : balls) {
-            if (ball.velocityX == 0.0f && ball.velocityY == 0.0f) {
-                ball.velocityX = 200.0f;
-                ball.velocityY = -200.0f;
+    // Тип клетки должен быть задан (set) до того, как она станет живой
+    void setAlive(int row, int col, bool value) {
+        const int stored = physicalRow(row);
+        const int chunk = chunkIndex(stored, col);
+        const int word = wordIndex(stored, col);
+        const int index = cellIndex(stored, col);
+        const uint64_t bit = uint64_t(1) << (col % GRID_CHUNK_SIZE);
+        const uint64_t rowBit = uint64_t(1) << (stored % GRID_CHUNK_SIZE);
+        const uint64_t chunkBit = uint64_t(1) << (chunk % 64);
+        if (isAlive(row, col) != value)
+            hash ^= cellHashKey(index, cells[index]);
+        changeLog[revision % CHANGE_LOG_SIZE] = row * cols + col;
+        revision++;
+        if (value) {
+            alive[word] |= bit;
+            aliveRows[chunk] |= rowBit;
+            aliveChunks[chunk / 64] |= chunkBit;
+            if (!blockTypeInfo(type(row, col)).indestructible) {
+                breakable[word] |= bit;
+                breakableRows[chunk] |= rowBit;
+                breakableChunks[chunk / 64] |= chunkBit;
             }
-            stickyBall = false;
-            startFlag = false;
         }
+        else {
+            alive[word] &= ~bit;
+            breakable[word] &= ~bit;
+            updateSummaries(chunk, word, rowBit, chunkBit);
+        }
+    }
 
+    // Сбрасывает биты сводок опустевших строки и чанка
+    void updateSummaries(int chunk, int word, uint64_t rowBit, uint64_t chunkBit) {
+        if (!alive[word] && !(aliveRows[chunk] &= ~rowBit))
+            aliveChunks[chunk / 64] &= ~chunkBit;
+        if (!breakable[word] && !(breakableRows[chunk] &= ~rowBit))
+            breakableChunks[chunk / 64] &= ~chunkBit;
     }
-}
 
-void destroy(Block& block) {
-    // Уничтожение разрушаемого блока
-    if (block.type != INDESTRUCTIBLE) {
-        block.health--;
-        score += 1;
-        if (block.health <= 0) {
-            block.destroyed = true;
+    // Сдвиг поля на строку вниз: нижняя строка пропадает, а ее память становится
+    // новой пустой строкой 0. Клетки не копируются, меняется только rowOffset.
+    void scrollDown() {
+        const int stored = physicalRow(rows - 1);
+        for (int chunkCol = 0; chunkCol < chunkCols; chunkCol++) {
+            const int chunk = chunkIndex(stored, chunkCol * GRID_CHUNK_SIZE);
+            const int word = wordIndex(stored, chunkCol * GRID_CHUNK_SIZE);
+            uint8_t* rowCells = &cells[word * GRID_CHUNK_SIZE];
+            forEachSetBit(&alive[word], 0, GRID_CHUNK_SIZE, [&](int col) {
+                hash ^= cellHashKey(word * GRID_CHUNK_SIZE + col, rowCells[col]);
+            });
+            std::memset(rowCells, 0, GRID_CHUNK_SIZE);
+            alive[word] = 0;
+            breakable[word] = 0;
+            updateSummaries(chunk, word, uint64_t(1) << (stored % GRID_CHUNK_SIZE), uint64_t(1) << (chunk % 64));
         }
-        if (block.type == SPEED_UP) {
-            for (auto& ball : balls) {
-                ball.velocityX *= 1.2f;
-                ball.velocityY *= 1.2f;
-            }
-            return;
+        rowOffset = stored;
+        // Сдвинулись все блоки
+        revision += CHANGE_LOG_SIZE;
+    }
+
+    bool hasBreakable() const {
+        const int summaryWords = (chunkRows * chunkCols + 63) / 64;
+        for (int w = 0; w < summaryWords; w++) {
+            if (breakableChunks[w])
+                return true;
         }
-        // Создание бонуса
-        if (std::rand() % 100 < 37) {
-            Bonus bonus;
-            bonus.x = block.x + block.width / 2 - 10.0f;
-            bonus.y = block.y + block.height / 2 - 10.0f;
-            bonus.width = 20.0f;
-            bonus.height = 20.0f;
-            bonus.active = true;
-            bonus.type = static_cast<BonusType>(std::rand() % 8);
-            bonuses.push_back(bonus);
+        return false;
+    }
+
+    int aliveCount() const {
+        return countBits(alive, aliveRows, aliveChunks);
+    }
+
+    int breakableCount() const {
+        return countBits(breakable, breakableRows, breakableChunks);
+    }
+
+    int countBits(const uint64_t* bits, const uint64_t* rowSummary, const uint64_t* chunkSummary) const {
+        int count = 0;
+        forEachSetBit(chunkSummary, 0, chunkRows * chunkCols, [&](int chunk) {
+            forEachSetBit(&rowSummary[chunk], 0, GRID_CHUNK_SIZE, [&](int r) {
+                count += popCount(bits[chunk * GRID_CHUNK_SIZE + r]);
+            });
+        });
+        return count;
+    }
+
+    // visit(row, col) для живых клеток из диапазона строк и столбцов. Маски
+    // копируются до вызова visit, поэтому внутри можно разрушать блоки.
+    template <typename Visitor>
+    void forEachAlive(int rowBegin, int rowEnd, int colBegin, int colEnd, Visitor visit) const {
+        forEachInRange(alive, aliveRows, aliveChunks, rowBegin, rowEnd, colBegin, colEnd, visit);
+    }
+
+    template <typename Visitor>
+    void forEachAlive(Visitor visit) const {
+        forEachAlive(0, rows, 0, cols, visit);
+    }
+
+    template <typename Visitor>
+    void forEachBreakable(Visitor visit) const {
+        forEachInRange(breakable, breakableRows, breakableChunks, 0, rows, 0, cols, visit);
+    }
+
+    template <typename Visitor>
+    void forEachInRange(const uint64_t* bits, const uint64_t* rowSummary, const uint64_t* chunkSummary,
+        int rowBegin, int rowEnd, int colBegin, int colEnd, Visitor visit) const {
+        if (rowBegin >= rowEnd || colBegin >= colEnd)
+            return;
+        // В памяти диапазон строк - один отрезок или два, если он переходит через конец
+        const int begin = rowBegin + rowOffset, end = rowEnd + rowOffset;
+        if (begin < rows)
+            forEachStored(bits, rowSummary, chunkSummary, begin, std::min(end, rows), colBegin, colEnd, rowOffset, visit);
+        if (end > rows)
+            forEachStored(bits, rowSummary, chunkSummary, std::max(begin, rows) - rows, end - rows, colBegin, colEnd,
+                rowOffset - rows, visit);
+    }
+
+    // Строки в памяти [begin, end), строка для visit - номер в памяти минус shift
+    template <typename Visitor>
+    void forEachStored(const uint64_t* bits, const uint64_t* rowSummary, const uint64_t* chunkSummary,
+        int begin, int end, int colBegin, int colEnd, int shift, Visitor visit) const {
+        const int firstChunkCol = colBegin / GRID_CHUNK_SIZE, lastChunkCol = (colEnd - 1) / GRID_CHUNK_SIZE;
+        for (int chunkRow = begin / GRID_CHUNK_SIZE; chunkRow * GRID_CHUNK_SIZE < end; chunkRow++) {
+            const int top = chunkRow * GRID_CHUNK_SIZE;
+            const int rowLow = std::max(begin - top, 0), rowHigh = std::min(end - top, GRID_CHUNK_SIZE);
+            const int firstChunk = chunkRow * chunkCols;
+            forEachSetBit(chunkSummary, firstChunk + firstChunkCol, firstChunk + lastChunkCol + 1, [&](int chunk) {
+                const int left = (chunk - firstChunk) * GRID_CHUNK_SIZE;
+                const int colLow = std::max(colBegin - left, 0), colHigh = std::min(colEnd - left, GRID_CHUNK_SIZE);
+                forEachSetBit(&rowSummary[chunk], rowLow, rowHigh, [&](int r) {
+                    const int row = top + r - shift;
+                    forEachSetBit(&bits[chunk * GRID_CHUNK_SIZE + r], colLow, colHigh, [&](int c) { visit(row, left + c); });
+                });
+            });
         }
     }
-}
 
-void updateBall(Ball& ball, float deltaTime) {
-    ball.x += ball.velocityX * deltaTime;
-    ball.y += ball.velocityY * deltaTime;
+    // Байт клетки: тип в старшей тетраде, здоровье в младшей
+    uint8_t cell(int row, int col) const {
+        return cells[cellIndex(physicalRow(row), col)];
+    }
+
+    BlockType type(int row, int col) const {
+        return static_cast<BlockType>(cell(row, col) >> 4);
+    }
+
+    int health(int row, int col) const {
+        int value = cell(row, col) & 0x0F;
+        return value == CELL_HEALTH_INFINITE ? -1 : value;
+    }
+
+    void set(int row, int col, BlockType blockType, int blockHealth) {
+        int packedHealth = blockHealth < 0 ? CELL_HEALTH_INFINITE : std::min(blockHealth, CELL_HEALTH_INFINITE - 1);
+        const int index = cellIndex(physicalRow(row), col);
+        const uint8_t value = static_cast<uint8_t>((blockType << 4) | packedHealth);
+        if (isAlive(row, col))
+            hash ^= cellHashKey(index, cells[index]) ^ cellHashKey(index, value);
+        cells[index] = value;
+    }
+
+    // Полуинтервалы строк и столбцов, клетки которых может задеть прямоугольник
+    // [left, right] x [top, bottom]. Проверка точного пересечения остается за вызывающим.
+    void cellRange(Real left, Real top, Real right, Real bottom,
+        int& rowBegin, int& rowEnd, int& colBegin, int& colEnd) const {
+        rowBegin = std::max(0, floorToInt((top - BLOCK_HEIGHT) / BLOCK_STEP_Y));
+        rowEnd = std::min(rows, floorToInt(bottom / BLOCK_STEP_Y) + 1);
+        colBegin = std::max(0, floorToInt((left - BLOCK_WIDTH) / BLOCK_STEP_X));
+        colEnd = std::min(cols, floorToInt(right / BLOCK_STEP_X) + 1);
+    }
+
+    // Касание блока (row, col) шариком, центр которого проходит путь
+    // (x, y) + t * (dx, dy), t из [0, 1]. Шарик сталкивается как квадрат (см.
+    // checkCollision), поэтому это луч против блока, расширенного на радиус.
+    // Шарик, начавший путь внутри блока и движущийся вглубь, касается его при
+    // t = 0: он выталкивается по оси наименьшего перекрытия и отражается по ней.
+    bool sweepBlock(Real x, Real y, Real dx, Real dy, Real radius, int row, int col, BlockHit& hit) const {
+        const Real infinity = realInfinity();
+        const Real left = col * BLOCK_STEP_X - radius, right = col * BLOCK_STEP_X + BLOCK_WIDTH + radius;
+        const Real top = row * BLOCK_STEP_Y - radius, bottom = row * BLOCK_STEP_Y + BLOCK_HEIGHT + radius;
+
+        Real enterX = -infinity, exitX = infinity;
+        if (dx != 0.0f) {
+            enterX = (left - x) / dx;
+            exitX = (right - x) / dx;
+            if (enterX > exitX)
+                std::swap(enterX, exitX);
+        }
+        else if (x <= left || x >= right) {
+            return false;
+        }
+        Real enterY = -infinity, exitY = infinity;
+        if (dy != 0.0f) {
+            enterY = (top - y) / dy;
+            exitY = (bottom - y) / dy;
+            if (enterY > exitY)
+                std::swap(enterY, exitY);
+        }
+        else if (y <= top || y >= bottom) {
+            return false;
+        }
+
+        const Real enter = std::max(enterX, enterY);
+        if (enter < 0.0)
+            return pushOut(x, y, dx, dy, left, top, right, bottom, row, col, hit);
+        if (enter > 1.0 || enter >= std::min(exitX, exitY))
+            return false;
+        hit = { enter, row, col, enterX >= enterY, enterY >= enterX, 0.0f, 0.0f };
+        return true;
+    }
+
+    // Касание при t = 0 для центра (x, y) внутри расширенного блока. Шарик,
+    // который и так выходит из блока по оси наименьшего перекрытия, не трогается.
+    static bool pushOut(Real x, Real y, Real dx, Real dy, Real left, Real top, Real right, Real bottom,
+        int row, int col, BlockHit& hit) {
+        if (x <= left || x >= right || y <= top || y >= bottom)
+            return false;
+        const Real pushX = x - left < right - x ? left - x : right - x;
+        const Real pushY = y - top < bottom - y ? top - y : bottom - y;
+        if (realAbs(pushX) < realAbs(pushY)) {
+            if ((pushX < 0.0f) != (dx > 0.0f))
+                return false;
+            hit = { 0.0f, row, col, true, false, pushX, 0.0f };
+        }
+        else {
+            if ((pushY < 0.0f) != (dy > 0.0f))
+                return false;
+            hit = { 0.0f, row, col, false, true, 0.0f, pushY };
+        }
+        return true;
+    }
+
+    // Первый живой блок на пути (x, y) + t * (dx, dy). Клетки решетки, через
+    // которые проходит центр шарика, обходятся по порядку (Amanatides-Woo), в
+    // каждой проверяются блоки, которые шарик радиуса radius может задеть из этой
+    // клетки. Обход останавливается, когда следующая клетка начинается позже уже
+    // найденного касания, поэтому работа зависит от длины пути, а не от размера поля.
+    bool firstHit(Real x, Real y, Real dx, Real dy, Real radius, BlockHit& hit) const {
+        const Real infinity = realInfinity();
+
+        // Отрезок обрезается по прямоугольнику поля, расширенному на радиус
+        Real tBegin = 0.0, tEnd = 1.0;
+        auto clip = [&](Real origin, Real delta, Real low, Real high) {
+            if (delta == 0.0) {
+                if (origin < low || origin > high)
+                    tEnd = -1.0;
+                return;
+            }
+            Real t0 = (low - origin) / delta, t1 = (high - origin) / delta;
+            if (t0 > t1)
+                std::swap(t0, t1);
+            tBegin = std::max(tBegin, t0);
+            tEnd = std::min(tEnd, t1);
+        };
+        clip(x, dx, -radius, cols * BLOCK_STEP_X + radius);
+        clip(y, dy, -radius, rows * BLOCK_STEP_Y + radius);
+        if (tBegin > tEnd)
+            return false;
+
+        int col = floorToInt((x + dx * tBegin) / BLOCK_STEP_X);
+        int row = floorToInt((y + dy * tBegin) / BLOCK_STEP_Y);
+        const int stepCol = dx > 0.0f ? 1 : -1;
+        const int stepRow = dy > 0.0f ? 1 : -1;
+        Real nextColT = dx != 0.0f ? ((col + (dx > 0.0f)) * BLOCK_STEP_X - x) / dx : infinity;
+        Real nextRowT = dy != 0.0f ? ((row + (dy > 0.0f)) * BLOCK_STEP_Y - y) / dy : infinity;
+        const Real colDeltaT = dx != 0.0f ? BLOCK_STEP_X / realAbs(dx) : infinity;
+        const Real rowDeltaT = dy != 0.0f ? BLOCK_STEP_Y / realAbs(dy) : infinity;
+
+        hit.t = infinity;
+        for (;;) {
+            int rowBegin, rowEnd, colBegin, colEnd;
+            cellRange(col * BLOCK_STEP_X - radius, row * BLOCK_STEP_Y - radius,
+                (col + 1) * BLOCK_STEP_X + radius, (row + 1) * BLOCK_STEP_Y + radius,
+                rowBegin, rowEnd, colBegin, colEnd);
+            forEachAlive(rowBegin, rowEnd, colBegin, colEnd, [&](int r, int c) {
+                BlockHit candidate;
+                if (sweepBlock(x, y, dx, dy, radius, r, c, candidate) && candidate.t < hit.t)
+                    hit = candidate;
+            });
+
+            const Real cellEnd = std::min(nextColT, nextRowT);
+            if (cellEnd >= hit.t || cellEnd > tEnd)
+                break;
+            if (nextColT < nextRowT) {
+                col += stepCol;
+                nextColT += colDeltaT;
+            }
+            else {
+                row += stepRow;
+                nextRowT += rowDeltaT;
+            }
+        }
+        return hit.t <= 1.0;
+    }
+
+    // Менялась ли с ревизии since живая клетка, блок которой, расширенный на
+    // radius, задевает прямоугольник [left, right] x [top, bottom]. Если журнал
+    // с тех пор переполнился, ответ - да.
+    bool changedSince(uint32_t since, Real radius, Real left, Real top, Real right, Real bottom) const {
+        if (revision - since >= static_cast<uint32_t>(CHANGE_LOG_SIZE))
+            return true;
+        for (uint32_t i = since; i != revision; i++) {
+            const int cell = changeLog[i % CHANGE_LOG_SIZE];
+            const Real blockX = (cell % cols) * BLOCK_STEP_X, blockY = (cell / cols) * BLOCK_STEP_Y;
+            if (blockX - radius <= right && blockX + BLOCK_WIDTH + radius >= left &&
+                blockY - radius <= bottom && blockY + BLOCK_HEIGHT + radius >= top)
+                return true;
+        }
+        return false;
+    }
+
+    // Блок как отдельный объект (для проверок столкновений и отрисовки)
+    Block block(int row, int col) const {
+        return { col * BLOCK_STEP_X, row * BLOCK_STEP_Y, BLOCK_WIDTH, BLOCK_HEIGHT,
+            type(row, col), health(row, col), !isAlive(row, col) };
+    }
+};
+
+const Real BONUS_FALL_SPEED = 100.0f;
+
+struct Bonus {
+    Real x, y;
+    Real width, height;
+    BonusType type;
+    bool active;
+    int next; // Свободная ячейка пула: следующая свободная. Занятая: позиция в списке живых.
+};
+
+// Пул бонусов фиксированной емкости. Свободные ячейки связаны в список через
+// Bonus::next, живые перечислены подряд в live, поэтому обход идет только по
+// падающим бонусам, а память не растет за сессию. Если пул полон, новый бонус
+// не выпадает. Память пула берется из арены уровня.
+const int BONUS_POOL_CAPACITY = 1024;
+
+struct BonusPool {
+    Bonus* slots = nullptr;
+    int* live = nullptr;
+    int capacity = 0;
+    int liveCount = 0;
+    int freeHead = -1;
+
+    static size_t arenaBytes(int numSlots) {
+        return LevelArena::bytesFor<Bonus>(numSlots) + LevelArena::bytesFor<int>(numSlots);
+    }
+
+    void reset(int numSlots, LevelArena& arena) {
+        slots = arena.allocate<Bonus>(numSlots);
+        live = arena.allocate<int>(numSlots);
+        capacity = numSlots;
+        clear();
+    }
+
+    void clear() {
+        for (int i = 0; i < capacity; i++) {
+            slots[i].active = false;
+            slots[i].next = i + 1 < capacity ? i + 1 : -1;
+        }
+        liveCount = 0;
+        freeHead = capacity > 0 ? 0 : -1;
+    }
+
+    int size() const {
+        return liveCount;
+    }
+
+    // i-й живой бонус, 0 <= i < size()
+    Bonus& operator[](int i) {
+        return slots[live[i]];
+    }
+
+    const Bonus& operator[](int i) const {
+        return slots[live[i]];
+    }
+
+    Bonus* spawn() {
+        if (freeHead < 0)
+            return nullptr;
+        int slot = freeHead;
+        Bonus& bonus = slots[slot];
+        freeHead = bonus.next;
+        bonus.next = liveCount;
+        bonus.active = true;
+        live[liveCount++] = slot;
+        return &bonus;
+    }
+
+    // Удаляет i-й живой бонус: на его место в списке встает последний.
+    // При обходе с удалением идти нужно с конца.
+    void removeAt(int i) {
+        int slot = live[i];
+        int last = live[--liveCount];
+        live[i] = last;
+        slots[last].next = i;
+        slots[slot].active = false;
+        slots[slot].next = freeHead;
+        freeHead = slot;
+    }
+};
+
+// Game state
+thread_local int score;
+thread_local int lives;
+thread_local int stickyWait;
+thread_local bool stickyBall;
+thread_local bool oneTimeBottom = false;
+thread_local bool startFlag;
+thread_local int levelLoads = 0;
+thread_local LevelArena levelArena;
+thread_local BlockGrid blockGrid;
+thread_local std::vector<Ball> balls;
+// Широкая фаза столкновений шариков: шарики по возрастанию ячейки сетки
+struct BallCell {
+    int64_t cell;
+    int index;
+
+    bool operator<(const BallCell& other) const {
+        return cell < other.cell || (cell == other.cell && index < other.index);
+    }
+};
+
+thread_local std::vector<BallCell> ballOrder;
+thread_local BonusPool bonuses;
+// Конец уровня: обычно сразу начинается новый, партии оценщика вместо этого
+// останавливаются с levelEnded = true
+thread_local bool restartOnLevelEnd = true;
+thread_local bool levelEnded = false;
+
+// Настройки окна, общие для всех потоков
+bool aimAssist = false; // Рисовать предсказанный путь шариков
+bool autopilot = false; // Платформой управляет autopilotPaddleX
+
+// Камера: левый верхний угол видимой части поля (updateCamera). Нужна только
+// отрисовке и переводу координат мыши, на симуляцию не влияет.
+struct Camera {
+    float x = 0.0f, y = 0.0f;
+} camera;
+
+// Игровое поле не меньше окна, а поле блоков больше окна расширяет его. Под
+// нижней строкой блоков остается FIELD_BOTTOM_MARGIN до низа поля.
+const Real FIELD_BOTTOM_MARGIN = 150.0f;
+
+Real fieldWidth() {
+    return std::max(Real(WIDTH), blockGrid.cols * BLOCK_STEP_X);
+}
+
+Real fieldHeight() {
+    return std::max(Real(HEIGHT), blockGrid.rows * BLOCK_STEP_Y + FIELD_BOTTOM_MARGIN);
+}
+
+// Структурные изменения за тик: появление и удаление шариков и бонусов и
+// перезапуск уровня. Во время обхода они только записываются сюда, а применяются
+// одной пачкой в конце тика (applyTickCommands), поэтому обходы balls и bonuses
+// не ломаются, а удаление стоит O(1) (последний элемент встает на место удаленного).
+struct TickCommands {
+    std::vector<int> despawnBalls; // индексы в balls
+    std::vector<int> despawnBonuses; // индексы живых бонусов в bonuses
+    std::vector<Ball> spawnBalls;
+    std::vector<Bonus> spawnBonuses;
+    bool restartLevel = false;
+
+    void reserve(size_t maxBalls, size_t maxBonuses) {
+        despawnBalls.reserve(maxBalls);
+        spawnBalls.reserve(maxBalls);
+        despawnBonuses.reserve(maxBonuses);
+        spawnBonuses.reserve(maxBonuses);
+    }
+
+    void clear() {
+        despawnBalls.clear();
+        despawnBonuses.clear();
+        spawnBalls.clear();
+        spawnBonuses.clear();
+        restartLevel = false;
+    }
+};
+
+thread_local TickCommands tickCommands;
+
+bool isBoardCleared() {
+    return !blockGrid.hasBreakable();
+};
+
+bool checkCollision(const Ball& ball, const Paddle& paddle) {
+    return ball.x + ball.radius >= paddle.x && ball.x - ball.radius <= paddle.x + paddle.width &&
+        ball.y + ball.radius >= paddle.y && ball.y - ball.radius <= paddle.y + paddle.height;
+}
+
+bool checkCollision(Ball& ball, Block& block) {
+    return !block.destroyed &&
+        ball.x + ball.radius > block.x && ball.x - ball.radius < block.x + block.width &&
+        ball.y + ball.radius > block.y && ball.y - ball.radius < block.y + block.height;
+}
+
+bool checkCollision(Paddle& paddle, Bonus& bonus) {
+    return bonus.active &&
+        paddle.x < bonus.x + bonus.width && paddle.x + paddle.width > bonus.x &&
+        paddle.y < bonus.y + bonus.height && paddle.y + paddle.height > bonus.y;
+}
+
+// Временные эффекты бонусов (ширина платформы, скорость шариков, липкость,
+// одноразовое дно) истекают через BonusTypeInfo::duration секунд. Сроки хранит
+// иерархическое колесо таймеров: WHEEL_LEVELS уровней по WHEEL_SLOTS ячеек,
+// ячейка нижнего уровня - один тик эффектов (EFFECT_TICK), следующих - 64 и
+// 4096 тиков. Эффект кладется в ячейку по сроку; когда нижний уровень проходит
+// круг, очередная ячейка уровня выше раскладывается вниз. Тик трогает только
+// истекающие и спускаемые эффекты, поэтому стоит O(1) при любом их числе.
+const int EFFECT_TICKS_PER_SECOND = 60;
+const Real EFFECT_TICK = 1.0f / EFFECT_TICKS_PER_SECOND;
+const int WHEEL_BITS = 6;
+const int WHEEL_SLOTS = 1 << WHEEL_BITS;
+const int WHEEL_LEVELS = 3;
+const uint32_t WHEEL_MAX_DELAY = (1u << (WHEEL_BITS * WHEEL_LEVELS)) - 1; // ~73 минуты
+
+struct TimedEffect {
+    uint32_t expires; // Тик, на котором эффект истекает
+    BonusType type;
+    int next; // Следующий в ячейке или в списке свободных, -1 - конец
+};
+
+struct EffectWheel {
+    std::vector<TimedEffect> effects;
+    int freeList = -1;
+    int slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    uint32_t now = 0;
+    Real clock = 0.0f; // Время, еще не набравшее целый тик
+    int count = 0;
+    // Действующие эффекты по типам бонусов. Множители без срока (duration 0)
+    // тоже считаются здесь, но в колесо не попадают и не истекают.
+    int active[MAX_BONUS_TYPES];
+    Real ballScale = 1.0f; // Множитель скорости, уже примененный к шарикам
+    uint64_t digest = 0; // Сумма хэшей действующих эффектов для hashGameState
+
+    EffectWheel() {
+        clear();
+    }
+
+    void clear() {
+        effects.clear();
+        freeList = -1;
+        std::fill(&slots[0][0], &slots[0][0] + WHEEL_LEVELS * WHEEL_SLOTS, -1);
+        std::fill(active, active + MAX_BONUS_TYPES, 0);
+        ballScale = 1.0f;
+        now = 0;
+        clock = 0.0f;
+        count = 0;
+        digest = 0;
+    }
+
+    void reserve(size_t maxEffects) {
+        effects.reserve(maxEffects);
+    }
+
+    static uint64_t effectHash(const TimedEffect& effect) {
+        return mixHash(static_cast<uint64_t>(effect.expires) << 8 | effect.type);
+    }
+
+    int activeOf(BonusEffect effect) const {
+        int total = 0;
+        for (int type = 0; type < typeRegistry.numBonusTypes; type++) {
+            if (bonusTypeInfo(type).effect == effect)
+                total += active[type];
+        }
+        return total;
+    }
+
+    void addPermanent(BonusType type) {
+        active[type]++;
+        digest += mixHash(~static_cast<uint64_t>(type));
+    }
+
+    // Уровень - наименьший, чей круг покрывает оставшийся срок
+    int& slotFor(uint32_t expires) {
+        const uint32_t delay = expires - now;
+        int level = 0;
+        while (level + 1 < WHEEL_LEVELS && delay >= (1u << (WHEEL_BITS * (level + 1))))
+            level++;
+        return slots[level][(expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+    }
+
+    void link(int index) {
+        int& head = slotFor(effects[index].expires);
+        effects[index].next = head;
+        head = index;
+    }
+
+    // Заводит эффект, еще не привязанный к ячейке
+    int insert(uint32_t expires, BonusType type) {
+        int index;
+        if (freeList >= 0) {
+            index = freeList;
+            freeList = effects[index].next;
+        }
+        else {
+            index = static_cast<int>(effects.size());
+            effects.push_back({});
+        }
+        effects[index] = { expires, type, -1 };
+        count++;
+        active[type]++;
+        digest += effectHash(effects[index]);
+        return index;
+    }
+
+    void schedule(uint32_t delay, BonusType type) {
+        delay = std::max(1u, std::min(delay, WHEEL_MAX_DELAY));
+        link(insert(now + delay, type));
+    }
+
+    // Один тик: спускает ячейки верхних уровней, чей круг начался, и вызывает
+    // expire(type) для эффектов, истекающих на этом тике
+    template <typename Expire>
+    void tick(Expire expire) {
+        now++;
+        for (int level = WHEEL_LEVELS - 1; level > 0; level--) {
+            if ((now & ((1u << (WHEEL_BITS * level)) - 1)) != 0)
+                continue;
+            int& slot = slots[level][(now >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+            int index = slot;
+            slot = -1;
+            while (index >= 0) {
+                const int next = effects[index].next;
+                link(index);
+                index = next;
+            }
+        }
+
+        int& slot = slots[0][now & (WHEEL_SLOTS - 1)];
+        int index = slot;
+        slot = -1;
+        while (index >= 0) {
+            TimedEffect& effect = effects[index];
+            const int next = effect.next;
+            count--;
+            active[effect.type]--;
+            digest -= effectHash(effect);
+            expire(effect.type);
+            effect.next = freeList;
+            freeList = index;
+            index = next;
+        }
+    }
+
+    // Снимок: тик, недобранная доля тика, примененный множитель скорости,
+    // счетчики по типам и ячейки колеса по порядку. Порядок в ячейках
+    // сохраняется, поэтому после загрузки эффекты истекают в том же порядке,
+    // что и без снимка. Множители без срока восстанавливаются по разнице
+    // счетчиков и эффектов в колесе.
+    void save(std::ostream& out) const {
+        out.write(reinterpret_cast<const char*>(&now), sizeof(now));
+        out.write(reinterpret_cast<const char*>(&clock), sizeof(clock));
+        out.write(reinterpret_cast<const char*>(&ballScale), sizeof(ballScale));
+        out.write(reinterpret_cast<const char*>(active), sizeof(active));
+        for (int level = 0; level < WHEEL_LEVELS; level++) {
+            for (int slot = 0; slot < WHEEL_SLOTS; slot++) {
+                uint32_t length = 0;
+                for (int index = slots[level][slot]; index >= 0; index = effects[index].next)
+                    length++;
+                out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+                for (int index = slots[level][slot]; index >= 0; index = effects[index].next) {
+                    const uint8_t type = effects[index].type;
+                    out.write(reinterpret_cast<const char*>(&effects[index].expires), sizeof(effects[index].expires));
+                    out.write(reinterpret_cast<const char*>(&type), sizeof(type));
+                }
+            }
+        }
+    }
+
+    bool load(std::istream& in) {
+        clear();
+        int savedActive[MAX_BONUS_TYPES];
+        Real savedBallScale = 1.0f;
+        in.read(reinterpret_cast<char*>(&now), sizeof(now));
+        in.read(reinterpret_cast<char*>(&clock), sizeof(clock));
+        in.read(reinterpret_cast<char*>(&savedBallScale), sizeof(savedBallScale));
+        in.read(reinterpret_cast<char*>(savedActive), sizeof(savedActive));
+        for (int level = 0; level < WHEEL_LEVELS && in; level++) {
+            for (int slot = 0; slot < WHEEL_SLOTS && in; slot++) {
+                uint32_t length = 0;
+                in.read(reinterpret_cast<char*>(&length), sizeof(length));
+                int last = -1;
+                for (uint32_t i = 0; i < length && in; i++) {
+                    uint32_t expires = 0;
+                    uint8_t type = 0;
+                    in.read(reinterpret_cast<char*>(&expires), sizeof(expires));
+                    in.read(reinterpret_cast<char*>(&type), sizeof(type));
+                    if (type >= typeRegistry.numBonusTypes) {
+                        in.setstate(std::ios::failbit);
+                        break;
+                    }
+                    const int index = insert(expires, static_cast<BonusType>(type));
+                    (last >= 0 ? effects[last].next : slots[level][slot]) = index;
+                    last = index;
+                }
+            }
+        }
+        for (int type = 0; type < MAX_BONUS_TYPES && in; type++) {
+            if (savedActive[type] < active[type]) {
+                in.setstate(std::ios::failbit);
+                break;
+            }
+            while (active[type] < savedActive[type])
+                addPermanent(static_cast<BonusType>(type));
+        }
+        if (!in) {
+            clear();
+            return false;
+        }
+        ballScale = savedBallScale;
+        return true;
+    }
+};
+
+thread_local EffectWheel bonusEffects;
+
+const Real PADDLE_BASE_WIDTH = 100.0f;
+const Real BALL_BASE_SPEED = 200.0f; // По каждой оси при запуске
+
+// Произведение множителей действующих эффектов вида effect. Считается заново
+// по счетчикам, поэтому после истечения эффекта значение точно прежнее.
+// Степень множителя каждого типа - возведением в квадрат, за O(log n) умножений.
+Real effectScale(BonusEffect effect) {
+    Real scale = 1.0f;
+    for (int type = 0; type < typeRegistry.numBonusTypes; type++) {
+        const BonusTypeInfo& info = bonusTypeInfo(type);
+        if (info.effect != effect)
+            continue;
+        Real base = info.effectValue;
+        for (int power = bonusEffects.active[type]; power > 0; power >>= 1) {
+            if (power & 1)
+                scale *= base;
+            if (power > 1)
+                base *= base;
+        }
+    }
+    return scale;
+}
+
+// Скорость запуска нового шарика с учетом действующих эффектов скорости
+Real ballLaunchSpeed() {
+    return BALL_BASE_SPEED * effectScale(EFFECT_BALL_SPEED);
+}
+
+// Ширина платформы - база, умноженная на действующие эффекты. Скорость шариков
+// так не посчитать: ее меняют ускоряющие блоки и удары шариков друг о друга.
+// Поэтому шарики, включая появляющиеся в этом тике, масштабируются отношением
+// нового множителя к уже примененному, а новые шарики запускаются сразу с
+// текущим множителем (ballLaunchSpeed).
+void applyEffectScales() {
+    paddle.width = PADDLE_BASE_WIDTH * effectScale(EFFECT_PADDLE_WIDTH);
+    const Real ballScale = effectScale(EFFECT_BALL_SPEED);
+    if (ballScale == bonusEffects.ballScale)
+        return;
+    const Real ratio = ballScale / bonusEffects.ballScale;
+    bonusEffects.ballScale = ballScale;
+    for (auto& ball : balls) {
+        ball.velocityX *= ratio;
+        ball.velocityY *= ratio;
+    }
+    for (auto& ball : tickCommands.spawnBalls) {
+        ball.velocityX *= ratio;
+        ball.velocityY *= ratio;
+    }
+}
+
+void applyBonus(BonusType type) {
+    const BonusTypeInfo& info = bonusTypeInfo(type);
+    switch (info.effect) {
+    case EFFECT_PADDLE_WIDTH:
+    case EFFECT_BALL_SPEED:
+        // Множитель без срока действует всегда, со сроком - до истечения
+        if (info.duration > 0.0f)
+            bonusEffects.schedule(static_cast<uint32_t>(info.duration * EFFECT_TICKS_PER_SECOND + 0.5f), type);
+        else
+            bonusEffects.addPermanent(type);
+        applyEffectScales();
+        return;
+    case EFFECT_STICKY:
+        stickyBall = true;
+        break;
+    case EFFECT_EXTRA_LIFE:
+        lives += static_cast<int>(info.effectValue);
+        return;
+    case EFFECT_EXTRA_BALL: {
+        if (!balls.empty()) {
+            stickyWait = 0;
+            stickyBall = false;
+            Ball newBall = { paddle.x + paddle.width / 2, paddle.y - 10.0f, 10.0f, ballLaunchSpeed(), -ballLaunchSpeed() };
+            tickCommands.spawnBalls.push_back(newBall);
+            return;
+        }
+    }
+    case EFFECT_BOTTOM_SHIELD:
+        oneTimeBottom = true;
+        break;
+    default:
+        return;
+    }
+
+    if (info.duration > 0.0f)
+        bonusEffects.schedule(static_cast<uint32_t>(info.duration * EFFECT_TICKS_PER_SECOND + 0.5f), type);
+}
+
+// Снимает истекший эффект: множители пересчитываются от базы, флаги
+// сбрасываются, когда истек последний эффект того же вида
+void expireBonus(BonusType type) {
+    switch (bonusTypeInfo(type).effect) {
+    case EFFECT_PADDLE_WIDTH:
+    case EFFECT_BALL_SPEED:
+        applyEffectScales();
+        break;
+    case EFFECT_STICKY:
+        // Шарик, который платформа уже держит, отпускается как обычно
+        if (bonusEffects.activeOf(EFFECT_STICKY) == 0 && !startFlag && stickyWait == 0)
+            stickyBall = false;
+        break;
+    case EFFECT_BOTTOM_SHIELD:
+        if (bonusEffects.activeOf(EFFECT_BOTTOM_SHIELD) == 0)
+            oneTimeBottom = false;
+        break;
+    default:
+        break;
+    }
+}
+
+void advanceBonusEffects(Real deltaTime) {
+    bonusEffects.clock += deltaTime;
+    while (bonusEffects.clock >= EFFECT_TICK) {
+        bonusEffects.clock -= EFFECT_TICK;
+        bonusEffects.tick(expireBonus);
+    }
+}
+
+// Стандартная ширина поля в блоках и наибольшее число рядов в initGame
+const int FIELD_COLUMNS = 10;
+const int MAX_FIELD_ROWS = 10;
+
+// Размер поля уровня (--rows, --cols); 0 строк - случайное число от 4 до MAX_FIELD_ROWS
+struct LevelSize {
+    int rows = 0;
+    int cols = FIELD_COLUMNS;
+} levelSize;
+
+// Рабочие буферы генераторов: две строки по numCols
+size_t generatorScratchBytes(int numCols) {
+    return 2 * LevelArena::bytesFor<int>(numCols);
+}
+
+// Начало уровня: сброс арены и пустые сетка и пул бонусов в ней. Память прошлого
+// уровня переиспользуется целиком, указатели на нее после вызова недействительны.
+void beginLevel(int numRows, int numCols) {
+    levelArena.reset(std::max(BlockGrid::arenaBytes(numRows, numCols), BlockGrid::arenaBytes(MAX_FIELD_ROWS, FIELD_COLUMNS)) +
+        BonusPool::arenaBytes(BONUS_POOL_CAPACITY) + generatorScratchBytes(std::max(numCols, FIELD_COLUMNS)));
+    blockGrid.reset(numRows, numCols, levelArena);
+    bonuses.reset(BONUS_POOL_CAPACITY, levelArena);
+}
+
+// Бесконечный режим (--endless): поле из ENDLESS_ROWS строк раз в
+// ENDLESS_ROW_SECONDS сдвигается на строку вниз. Нижняя строка пропадает, ее
+// память в BlockGrid становится новой верхней строкой, а блоки в ней строятся
+// по правилу патернового генератора от бывшей верхней строки. Сетка и пул
+// бонусов создаются один раз за партию, сколько бы она ни длилась.
+const int ENDLESS_ROWS = 15;
+const int ENDLESS_START_ROWS = 5;
+const Real ENDLESS_ROW_SECONDS = 6.0f;
+
+struct EndlessMode {
+    bool enabled = false;
+    Real rowTimer = 0.0f; // Секунд до следующего сдвига
+    uint16_t topRow = 0;  // Непробиваемые клетки верхней строки
+    long long rowsGenerated = 0;
+};
+
+thread_local EndlessMode endless;
+
+void generateSymmetricField(int numRows, int numCols = FIELD_COLUMNS);
+void generatePatternedField(int numRows, int numCols = FIELD_COLUMNS);
+void generateStripedField(int numRows, int numCols = FIELD_COLUMNS);
+Real autopilotPaddleX(Real deltaTime);
+void beginEndlessLevel();
+void reserveBallSteps();
+void reserveTrajectories();
+
+// Платформа внизу поля, один шарик на ней и начальные счет и жизни.
+// Поле уровня к этому моменту уже должно быть построено.
+void resetPlayer() {
+    score = 0;
+    lives = 3;
+    startFlag = true;
+    stickyBall = true;
+    // Сроки эффектов относятся к прежним платформе и шарикам
+    bonusEffects.clear();
+
+    paddle.x = fieldWidth() / 2.0f - 50.0f;
+    paddle.y = fieldHeight() - 30.0f;
+    paddle.width = PADDLE_BASE_WIDTH;
+    paddle.height = 20.0f;
+    paddle.speed = 500.0f;
+
+    balls.clear();
+    Ball initialBall = { paddle.x + paddle.width / 2, paddle.y - 10.0f, 10.0f, 0.0f, 0.0f };
+    balls.push_back(initialBall);
+}
+
+// Бонус выпадает не чаще одного раза за удар по блоку, а новый шарик
+// появляется только из бонуса, поэтому после резерва в кадре
+// push_back в balls уже не выделяет память
+void reserveForLevel() {
+    size_t maxHits = 0;
+    blockGrid.forEachBreakable([&](int row, int col) {
+        maxHits += blockGrid.health(row, col);
+    });
+    balls.reserve(balls.size() + maxHits);
+    ballOrder.reserve(balls.capacity());
+    tickCommands.reserve(balls.capacity(), BONUS_POOL_CAPACITY);
+    bonusEffects.reserve(balls.capacity());
+    reserveBallSteps();
+    reserveTrajectories();
+}
+
+// Набор уровней (level pack) - двоичный файл: заголовок, индекс со смещениями
+// уровней и сетки уровней фиксированного размера gridRows x gridCols. Байт
+// клетки такой же, как в BlockGrid::cells (тип в старшей тетраде, здоровье в
+// младшей), 0 - пустая клетка. Файл отображается в память (mmap или
+// MapViewOfFile) и ничего не читается заранее: загрузка уровня k трогает только
+// заголовок, запись индекса и страницы своей сетки. Числа в файле little-endian.
+const char LEVEL_PACK_MAGIC[4] = { 'A', 'R', 'K', 'L' };
+const uint32_t LEVEL_PACK_VERSION = 1;
+
+struct LevelPackHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t levelCount;
+    uint16_t gridRows, gridCols; // Размер сетки каждой записи
+};
+
+struct LevelPackEntry {
+    uint64_t offset; // Начало сетки от начала файла
+    uint16_t rows, cols; // Размер поля уровня, не больше сетки записи
+    uint32_t reserved;
+};
+
+// Файл, отображенный в память только для чтения
+struct MappedFile {
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        close();
+    }
+
+    bool open(const char* path) {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        LARGE_INTEGER fileSize;
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+            close();
+            return false;
+        }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (!view) {
+            close();
+            return false;
+        }
+        data = static_cast<const unsigned char*>(view);
+        size = static_cast<size_t>(fileSize.QuadPart);
+#else
+        const int fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        void* view = MAP_FAILED;
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+            view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (view == MAP_FAILED)
+            return false;
+        data = static_cast<const unsigned char*>(view);
+        size = static_cast<size_t>(info.st_size);
+#endif
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (data)
+            UnmapViewOfFile(data);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data)
+            munmap(const_cast<unsigned char*>(data), size);
+#endif
+        data = nullptr;
+        size = 0;
+    }
+};
+
+struct LevelPack {
+    MappedFile file;
+    LevelPackHeader header = {};
+
+    bool isOpen() const {
+        return file.data != nullptr;
+    }
+
+    int levelCount() const {
+        return isOpen() ? static_cast<int>(header.levelCount) : 0;
+    }
+
+    // Проверяются заголовок и размер индекса, записи уровней - при загрузке
+    bool open(const char* path) {
+        if (!file.open(path)) {
+            std::cerr << "Failed to map level pack " << path << std::endl;
+            return false;
+        }
+        if (file.size < sizeof(header)) {
+            std::cerr << "Invalid level pack " << path << std::endl;
+            file.close();
+            return false;
+        }
+        std::memcpy(&header, file.data, sizeof(header));
+        if (std::memcmp(header.magic, LEVEL_PACK_MAGIC, sizeof(header.magic)) != 0 || header.version != LEVEL_PACK_VERSION ||
+            header.gridRows == 0 || header.gridCols == 0 ||
+            (file.size - sizeof(header)) / sizeof(LevelPackEntry) < header.levelCount) {
+            std::cerr << "Invalid level pack " << path << std::endl;
+            file.close();
+            return false;
+        }
+        return true;
+    }
+
+    // Запись индекса уровня k; false, если сетка уровня не помещается в файл
+    bool entry(int k, LevelPackEntry& result) const {
+        if (k < 0 || k >= levelCount())
+            return false;
+        std::memcpy(&result, file.data + sizeof(header) + k * sizeof(LevelPackEntry), sizeof(result));
+        const uint64_t gridBytes = static_cast<uint64_t>(header.gridRows) * header.gridCols;
+        return result.rows <= header.gridRows && result.cols <= header.gridCols &&
+            result.offset <= file.size && gridBytes <= file.size - result.offset;
+    }
+};
+
+// Открывается в main до первого уровня и дальше только читается, в том числе
+// потоком предзагрузки
+LevelPack levelPack;
+
+// Уровень k набора в поле текущего потока. Уровень с клеткой неизвестного типа
+// или с недопустимым для типа здоровьем отвергается целиком: тогда вызывающий
+// строит случайный уровень.
+bool loadPackLevel(const LevelPack& pack, int k) {
+    LevelPackEntry entry;
+    if (!pack.entry(k, entry))
+        return false;
+    const unsigned char* grid = pack.file.data + entry.offset;
+    for (int i = 0; i < entry.rows; i++) {
+        for (int j = 0; j < entry.cols; j++) {
+            const uint8_t value = grid[i * pack.header.gridCols + j];
+            if (value == 0)
+                continue;
+            const int type = value >> 4, health = value & 0x0F;
+            const bool valid = type < typeRegistry.numBlockTypes && (blockTypeInfo(type).indestructible ?
+                health == CELL_HEALTH_INFINITE : health >= 1 && health < CELL_HEALTH_INFINITE);
+            if (!valid) {
+                std::cerr << "Invalid cell " << i << ',' << j << " in pack level " << k << std::endl;
+                return false;
+            }
+        }
+    }
+
+    beginLevel(entry.rows, entry.cols);
+    for (int i = 0; i < entry.rows; i++) {
+        for (int j = 0; j < entry.cols; j++) {
+            const uint8_t value = grid[i * pack.header.gridCols + j];
+            if (value == 0)
+                continue;
+            const int health = value & 0x0F;
+            blockGrid.set(i, j, static_cast<BlockType>(value >> 4), health == CELL_HEALTH_INFINITE ? -1 : health);
+            blockGrid.setAlive(i, j, true);
+        }
+    }
+    return true;
+}
+
+// Ограничение оценки раскладок: флаг отмены и крайний срок. Проверяется по ходу
+// партий, поэтому прерванная оценка заканчивается за доли миллисекунды.
+struct EstimateBudget {
+    std::atomic<bool> cancelled{ false };
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+
+    bool exceeded() const {
+        return cancelled || std::chrono::steady_clock::now() >= deadline;
+    }
+};
+
+// Как generatePatternedField оценивает раскладки в текущем потоке. По умолчанию
+// на всех ядрах и без ограничений; раскладка, оценка которой не уложилась в
+// бюджет, принимается как есть. Поэтому взятая раскладка зависит от времени, и
+// ее номер сохраняется в записи игры, а при воспроизведении берется из нее.
+struct LayoutSearch {
+    int estimateThreads = 0;                // 0 - все ядра
+    const EstimateBudget* budget = nullptr; // nullptr - без ограничений
+    int forcedAttempt = -1;                 // >= 0: номер раскладки без оценки
+    int attempt = 0;                        // Номер последней взятой раскладки
+};
+
+thread_local LayoutSearch layoutSearch;
+
+// Случайное поле случайного генератора в арене уровня текущего потока
+void generateLevel(uint32_t seed) {
+    seedGameRandom(seed);
+    int numRows = 4 + gameRandom() % (MAX_FIELD_ROWS - 3);
+    if (levelSize.rows > 0)
+        numRows = levelSize.rows;
+    const int numCols = levelSize.cols;
+    beginLevel(numRows, numCols);
+    int generationType = gameRandom() % 3;
+    switch (generationType) {
+    case 0:
+        generateSymmetricField(numRows, numCols);
+        break;
+    case 1:
+        generatePatternedField(numRows, numCols);
+        break;
+    case 2:
+        generateStripedField(numRows, numCols);
+        break;
+    }
+}
+
+// Время на отбор раскладки в предзагрузчике
+const int PRELOAD_SEARCH_MS = 1000;
+
+// Следующий уровень строится заранее в рабочем потоке, пока идет текущий.
+// Поток генерирует поле в своих thread_local арене и сетке, которые на это
+// время подменяются буферами предзагрузчика, а при смене уровня главный поток
+// забирает готовые буферы, меняя их местами со своими. Буферы ходят по кругу,
+// поэтому память уровней переиспользуется. Раскладки поток оценивает сам, в
+// одном потоке и с бюджетом PRELOAD_SEARCH_MS, поэтому take() ждет не дольше
+// бюджета, а обычно поток давно закончил. Прерывается отбор только у уровня,
+// который больше не нужен (discard).
+struct LevelPreloader {
+    LevelArena arena;
+    BlockGrid grid;
+    BonusPool bonusPool;
+    std::thread worker;
+    EstimateBudget budget;
+    int attempt = 0; // Номер раскладки готового уровня (см. LayoutSearch)
+    // Номера раскладок взятых уровней по порядку. Пишутся в запись игры, а при
+    // воспроизведении (replaying) заказываются отсюда без оценки.
+    std::vector<uint8_t> attempts;
+    size_t replayedAttempts = 0;
+    bool replaying = false;
+
+    ~LevelPreloader() {
+        cancel();
+    }
+
+    void cancel() {
+        budget.cancelled = true;
+        if (worker.joinable())
+            worker.join();
+    }
+
+    void swapLevel() {
+        std::swap(levelArena, arena);
+        std::swap(blockGrid, grid);
+        std::swap(bonuses, bonusPool);
+    }
+
+    // Уровень packLevel из levelPack или, если его нет, случайный с зерном seed
+    void start(uint32_t seed, int packLevel) {
+        int forcedAttempt = -1;
+        if (replaying && replayedAttempts < attempts.size())
+            forcedAttempt = attempts[replayedAttempts++];
+        // При воспроизведении без номера (запись старого формата) отбор идет до
+        // конца, как шел при записи
+        budget.cancelled = false;
+        budget.deadline = replaying ? std::chrono::steady_clock::time_point::max() :
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(PRELOAD_SEARCH_MS);
+        worker = std::thread([this, seed, packLevel, forcedAttempt]() {
+            layoutSearch.estimateThreads = 1;
+            layoutSearch.budget = &budget;
+            layoutSearch.forcedAttempt = forcedAttempt;
+            layoutSearch.attempt = 0;
+            swapLevel();
+            if (packLevel < 0 || !loadPackLevel(levelPack, packLevel))
+                generateLevel(seed);
+            swapLevel();
+            attempt = layoutSearch.attempt;
+        });
+    }
+
+    // Заказанный уровень больше не нужен (новое зерно сессии). Номера раскладок
+    // начинаются заново; воспроизведение задает их после этого через replay().
+    void discard() {
+        cancel();
+        attempts.clear();
+        replayedAttempts = 0;
+        replaying = false;
+    }
+
+    void replay(const std::vector<uint8_t>& recorded) {
+        attempts = recorded;
+        replaying = true;
+    }
+
+    // Забирает уровень в текущий поток. Первый уровень сессии заказывается
+    // прямо перед take() и проходит тот же отбор, что и остальные.
+    void take() {
+        worker.join();
+        if (!replaying)
+            attempts.push_back(static_cast<uint8_t>(attempt));
+        const uint32_t revision = blockGrid.revision;
+        swapLevel();
+        // Ревизии сетки из другого потока не связаны с кэшами путей этого потока
+        blockGrid.revision = revision + BlockGrid::CHANGE_LOG_SIZE;
+    }
+};
+
+thread_local LevelPreloader levelPreloader;
+thread_local int nextPackLevel = 0; // Следующий уровень из levelPack
+
+// Начало сессии игры: уровень, заказанный при старом зерне, выбрасывается
+void seedSession(uint32_t seed) {
+    levelPreloader.discard();
+    seedGameRandom(seed);
+    nextPackLevel = 0;
+}
+
+// Заказ следующего уровня: по порядку из набора, если он открыт, иначе случайный
+void preloadNextLevel() {
+    int packLevel = -1;
+    if (levelPack.levelCount() > 0) {
+        packLevel = nextPackLevel;
+        nextPackLevel = (nextPackLevel + 1) % levelPack.levelCount();
+    }
+    levelPreloader.start(static_cast<uint32_t>(gameRandom()), packLevel);
+}
+
+// Генератор случайных чисел засевается один раз за сессию (main или запуск
+// записи), поэтому следующие уровни тоже повторяются при воспроизведении:
+// зерно каждого уровня берется из него при заказе предзагрузки.
+void initGame() {
+    levelLoads++;
+
+    if (endless.enabled) {
+        beginEndlessLevel();
+    }
+    else {
+        if (!levelPreloader.worker.joinable())
+            preloadNextLevel();
+        levelPreloader.take();
+        preloadNextLevel();
+    }
+    resetPlayer();
+    reserveForLevel();
+}
+
+// Клетка (i, j) должна входить в сетку, заданную beginLevel
+void addBlock(int i, int j, int randomTypeIndex) {
+    const BlockTypeInfo& info = blockTypeInfo(randomTypeIndex);
+    int health = info.indestructible ? -1 : info.healthOptions[gameRandom() % info.numHealthOptions];
+    blockGrid.set(i, j, static_cast<BlockType>(randomTypeIndex), health);
+    blockGrid.setAlive(i, j, true);
+}
+
+// Битовые раскладки поля: строка до 16 столбцов - это 16-битная маска, бит j -
+// столбец j. Генераторы ниже работают целыми строками через битовые операции и
+// случайные маски, без создания блоков, и выдают упакованную раскладку. Так можно
+// перебирать миллионы раскладок в поиске уровня нужной сложности.
+const int MAX_LAYOUT_COLUMNS = 16;
+const int MAX_LAYOUT_ROWS = 16;
+
+// Все клетки раскладки заполнены: непробиваемые в solid, ускоряющие в speedUp,
+// остальные - обычные разрушаемые
+struct PackedLayout {
+    int rows, cols;
+    uint16_t solid[MAX_LAYOUT_ROWS];
+    uint16_t speedUp[MAX_LAYOUT_ROWS];
+
+    uint16_t fullRow() const {
+        return static_cast<uint16_t>((1u << cols) - 1);
+    }
+};
+
+// Вероятность в процентах как числитель дроби x/256 для randomRowMask
+constexpr int maskOdds(int percent) {
+    return (percent * 256 + 50) / 100;
+}
+
+// Маска, каждый бит которой установлен с вероятностью odds/256. Двоичные цифры
+// вероятности обходятся от младшей: случайное слово объединяется с маской
+// (цифра 1) или пересекается с ней (цифра 0).
+uint16_t randomRowMask(int odds) {
+    uint32_t mask = 0;
+    for (int bit = 0; bit < 8; bit++) {
+        const uint32_t random = static_cast<uint32_t>(gameRandom());
+        mask = ((odds >> bit) & 1) ? (mask | random) : (mask & random);
+    }
+    return static_cast<uint16_t>(mask);
+}
+
+// Зеркальное отражение младших cols битов
+uint16_t mirrorRow(uint16_t row, int cols) {
+    uint32_t reversed = 0;
+    for (int j = 0; j < cols; j++)
+        reversed |= ((row >> j) & 1u) << (cols - 1 - j);
+    return static_cast<uint16_t>(reversed);
+}
+
+void generateSymmetricLayout(int numRows, int numCols, PackedLayout& layout) {
+    layout.rows = numRows;
+    layout.cols = numCols;
+    const uint16_t half = static_cast<uint16_t>((1u << ((numCols + 1) / 2)) - 1);
+    for (int i = 0; i < numRows; ++i) {
+        // 60% обычных, из остальных 74% ускоряющих, прочие непробиваемые
+        const uint16_t destructible = randomRowMask(maskOdds(60)) & half;
+        const uint16_t speedUp = randomRowMask(maskOdds(74)) & half & ~destructible;
+        const uint16_t solid = half & ~destructible & ~speedUp;
+        layout.solid[i] = solid | mirrorRow(solid, numCols);
+        layout.speedUp[i] = speedUp | mirrorRow(speedUp, numCols);
+    }
+}
+
+// Коридоры как в generatePatternedField: клетка может стать непробиваемой, если
+// над ней непробиваемый блок, или справа сверху проход, или слева сверху проход
+// и слева в этой строке проход. Последнее условие зависит от только что
+// выбранного соседа, поэтому такие клетки обходятся по порядку, остальные
+// решаются одной маской. Возвращает непробиваемые клетки строки после previous.
+uint16_t nextPatternedRow(uint16_t previous, uint16_t full) {
+    const uint16_t random = static_cast<uint16_t>(gameRandom()) & full;
+    const uint16_t open = ~previous & full;
+    // Проход справа сверху: бит j + 1 в open, последнего столбца нет
+    const uint16_t rightOpen = (open >> 1) & (full >> 1);
+    uint16_t current = random & (previous | rightOpen);
+    uint64_t pending = random & ~(previous | rightOpen) & (open << 1) & full;
+    while (pending) {
+        const int j = countTrailingZeros(pending);
+        pending &= pending - 1;
+        if (!((current >> (j - 1)) & 1))
+            current |= 1u << j;
+    }
+    return current;
+}
+
+// Ускоряющие клетки строки: 40% пробиваемых
+uint16_t patternedSpeedUpRow(uint16_t solid, uint16_t full) {
+    return ~solid & ~randomRowMask(maskOdds(60)) & full;
+}
+
+void generatePatternedLayout(int numRows, int numCols, PackedLayout& layout) {
+    layout.rows = numRows;
+    layout.cols = numCols;
+    const uint16_t full = layout.fullRow();
+    uint16_t previous = 0;
+    for (int i = 0; i < numRows; ++i) {
+        layout.solid[i] = nextPatternedRow(previous, full);
+        layout.speedUp[i] = patternedSpeedUpRow(layout.solid[i], full);
+        previous = layout.solid[i];
+    }
+}
+
+void generateStripedLayout(int numRows, int numCols, PackedLayout& layout) {
+    layout.rows = numRows;
+    layout.cols = numCols;
+    const uint16_t full = layout.fullRow();
+    const uint16_t evenColumns = 0x5555 & full;
+    for (int i = 0; i < numRows; ++i) {
+        layout.solid[i] = i % 2 == 0 ? evenColumns : 0;
+        layout.speedUp[i] = ~layout.solid[i] & ~randomRowMask(maskOdds(60)) & full;
+    }
+}
+
+// Раскладка в поле уровня; здоровье блоков выбирает addBlock
+void applyLayout(const PackedLayout& layout) {
+    for (int i = 0; i < layout.rows; ++i) {
+        for (int j = 0; j < layout.cols; ++j) {
+            BlockType type = DESTRUCTIBLE;
+            if ((layout.solid[i] >> j) & 1)
+                type = INDESTRUCTIBLE;
+            else if ((layout.speedUp[i] >> j) & 1)
+                type = SPEED_UP;
+            addBlock(i, j, type);
+        }
+    }
+}
+
+// Новая верхняя строка бесконечного режима
+void pushEndlessRow() {
+    blockGrid.scrollDown();
+    const uint16_t full = static_cast<uint16_t>((1u << FIELD_COLUMNS) - 1);
+    endless.topRow = nextPatternedRow(endless.topRow, full);
+    const uint16_t speedUp = patternedSpeedUpRow(endless.topRow, full);
+    for (int j = 0; j < FIELD_COLUMNS; j++) {
+        BlockType type = DESTRUCTIBLE;
+        if ((endless.topRow >> j) & 1)
+            type = INDESTRUCTIBLE;
+        else if ((speedUp >> j) & 1)
+            type = SPEED_UP;
+        addBlock(0, j, type);
+    }
+    endless.rowsGenerated++;
+}
+
+void beginEndlessLevel() {
+    beginLevel(ENDLESS_ROWS, FIELD_COLUMNS);
+    endless.rowTimer = ENDLESS_ROW_SECONDS;
+    endless.topRow = 0;
+    endless.rowsGenerated = 0;
+    for (int i = 0; i < ENDLESS_START_ROWS; i++)
+        pushEndlessRow();
+}
+
+void advanceEndless(Real deltaTime) {
+    endless.rowTimer -= deltaTime;
+    while (endless.rowTimer <= 0.0f) {
+        pushEndlessRow();
+        endless.rowTimer += ENDLESS_ROW_SECONDS;
+    }
+}
+
+bool fitsLayout(int numRows, int numCols) {
+    return numRows <= MAX_LAYOUT_ROWS && numCols <= MAX_LAYOUT_COLUMNS;
+}
+
+// Генераторы полей. Поля до 16 x 16 строятся через битовые раскладки, более
+// широкие (стресс-тест) - поклеточно.
+void generateSymmetricField(int numRows, int numCols) {
+    if (fitsLayout(numRows, numCols)) {
+        PackedLayout layout;
+        generateSymmetricLayout(numRows, numCols, layout);
+        applyLayout(layout);
+        return;
+    }
+    for (int i = 0; i < numRows; ++i) {
+        for (int j = 0; j < (numCols + 1) / 2; ++j) {
+            int mirror = numCols - j - 1;
+            int type;
+            if (gameRandom() % 100 < 60) {
+                type = 1;
+            }
+            else if (gameRandom() % 100 < 74) {
+                type = 2;
+            }
+            else {
+                type = 0;
+            }
+            addBlock(i, j, type);
+            if (mirror != j) {
+                addBlock(i, mirror, type);
+            }
+        }
+    }
+}
+
+// Отбор уровней по оценке estimateLayout (см. ниже): непроходимые и слишком
+// легкие раскладки generatePatternedField отбрасывает и строит новые
+struct LevelFilter {
+    bool enabled = true;
+    int runs = 16;              // Партий на раскладку
+    float minClearRate = 0.25f; // Непроходимая: автопилот проходит реже
+    float minClearTime = 60.0f; // Тривиальная: медиана прохождения быстрее, секунд
+    int maxAttempts = 6;        // Потом берется последняя раскладка
+} levelFilter;
+
+bool isAcceptedLayout(const PackedLayout& layout);
+
+void generatePatternedField(int numRows, int numCols) {
+    if (fitsLayout(numRows, numCols)) {
+        PackedLayout layout;
+        generatePatternedLayout(numRows, numCols, layout);
+        int attempt = 0;
+        if (layoutSearch.forcedAttempt >= 0) {
+            for (; attempt < layoutSearch.forcedAttempt; attempt++)
+                generatePatternedLayout(numRows, numCols, layout);
+        }
+        else {
+            for (; levelFilter.enabled && attempt + 1 < levelFilter.maxAttempts && !isAcceptedLayout(layout); attempt++)
+                generatePatternedLayout(numRows, numCols, layout);
+        }
+        layoutSearch.attempt = attempt;
+        applyLayout(layout);
+        return;
+    }
+    // Буферы строк берутся из арены уровня
+    int* previousRow = levelArena.allocate<int>(numCols); // 0 - пробиваемый блок, 1 - непробиваемый блок
+    int* currentRow = levelArena.allocate<int>(numCols); // Текущая строка
+    std::fill(previousRow, previousRow + numCols, 0);
+
+    for (int i = 0; i < numRows; ++i) {
+        std::fill(currentRow, currentRow + numCols, 0);
+
+        for (int j = 0; j < numCols; ++j) {
+            // Проверяем условия для создания коридоров
+            if (previousRow[j] == 0) {
+                if (j < numCols - 1 && previousRow[j + 1] == 0) {
+                    // Есть проход и на текущей и на следующей позиции
+                    currentRow[j] = (gameRandom() % 2 == 0) ? 0 : 1;
+                }
+                else if (j > 0 && previousRow[j - 1] == 0 && currentRow[j - 1] == 0) {
+                    // Есть проход на текущей и предыдущей позиции
+                    currentRow[j] = (gameRandom() % 2 == 0) ? 0 : 1;
+                }
+                else {
+                    // Иначе, делаем текущую позицию пробиваемой
+                    currentRow[j] = 0;
+                }
+            }
+            else {
+                // Ставим случайный блок, если на предыдущем ряду здесь непробиваемый блок
+                currentRow[j] = (gameRandom() % 2 == 0) ? 0 : 1;
+            }
+
+            // Добавляем блок в поле
+            if (currentRow[j] == 0) {
+                if (gameRandom() % 100 < 60) {
+                    addBlock(i, j, 1);
+                }
+                else {
+                    addBlock(i, j, 2);
+                }
+            }
+            else {
+                addBlock(i, j, 0); // Непробиваемый блок
+            }
+        }
+
+        std::swap(previousRow, currentRow); // Обновляем предыдущую строку
+    }
+}
+
+void generateStripedField(int numRows, int numCols) {
+    if (fitsLayout(numRows, numCols)) {
+        PackedLayout layout;
+        generateStripedLayout(numRows, numCols, layout);
+        applyLayout(layout);
+        return;
+    }
+    for (int i = 0; i < numRows; ++i) {
+        for (int j = 0; j < numCols; ++j) {
+            if (i % 2 == 0 && j % 2 == 0) {
+                addBlock(i, j, 0);
+            }
+            else {
+                if (gameRandom() % 100 < 60) {
+                    addBlock(i, j, 1);
+                }
+                else {
+                    addBlock(i, j, 2);
+                }
+            }
+        }
+    }
+}
+
+// Ввод игрока за кадр. Запись игры хранит именно его: applyInput повторяет
+// кадр без окна и мыши.
+struct PlayerInput {
+    Real paddleX;
+    bool launch;
+};
+
+void applyInput(const PlayerInput& input) {
+    Real deltaX = paddle.x;
+    paddle.x = input.paddleX;
+
+    // Ensure the paddle stays within bounds
+    if (paddle.x < 0.0f) paddle.x = 0.0f;
+    if (paddle.x + paddle.width > fieldWidth()) paddle.x = fieldWidth() - paddle.width;
+
+    deltaX -= paddle.x;
+    if (stickyBall) {
+        for (auto& ball : balls) {
+            if (startFlag || stickyWait > 0) {
+                if (ball.y - ball.radius <= paddle.y + paddle.height)
+                    ball.x -= deltaX;
+            }
+        }
+    }
+
+    // Launch the ball
+    if (input.launch && stickyBall) {
+        for (auto& ball : balls) {
+            if (ball.velocityX == 0.0f && ball.velocityY == 0.0f) {
+                ball.velocityX = ballLaunchSpeed();
+                ball.velocityY = -ballLaunchSpeed();
+            }
+            stickyBall = false;
+            startFlag = false;
+        }
+
+    }
+}
+
+// Читает и применяет ввод, возвращает его для записи
+PlayerInput processInput(GLFWwindow* window, float deltaTime) {
+    PlayerInput input;
+    input.paddleX = paddle.x;
+    if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
+        input.paddleX -= paddle.speed * deltaTime;
+    if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
+        input.paddleX += paddle.speed * deltaTime;
+
+    // F1 - подсказка прицела, F2 - автопилот
+    static bool aimKeyDown = false, autopilotKeyDown = false;
+    const bool aimKey = glfwGetKey(window, GLFW_KEY_F1) == GLFW_PRESS;
+    const bool autopilotKey = glfwGetKey(window, GLFW_KEY_F2) == GLFW_PRESS;
+    if (aimKey && !aimKeyDown)
+        aimAssist = !aimAssist;
+    if (autopilotKey && !autopilotKeyDown)
+        autopilot = !autopilot;
+    aimKeyDown = aimKey;
+    autopilotKeyDown = autopilotKey;
+
+    // Mouse control
+    if (autopilot) {
+        input.paddleX = autopilotPaddleX(deltaTime);
+    }
+    else {
+        double mouseX, mouseY;
+        glfwGetCursorPos(window, &mouseX, &mouseY);
+        // Окно по ширине соответствует всему полю: положение платформы зависит
+        // только от курсора, а не от камеры, которая сама следует за платформой
+        input.paddleX = static_cast<float>(mouseX) * toFloat(fieldWidth()) / WIDTH - paddle.width / 2.0f;
+    }
+    input.launch = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS || autopilot;
+
+    applyInput(input);
+    return input;
+}
+
+// Частицы: осколки блоков в цвет типа блока и искры от платформы. Это только
+// картинка: у пула свой генератор случайных чисел, в хэш состояния и записи он
+// не входит. Пул фиксированного размера хранится структурой массивов, движение
+// считается по четыре частицы за инструкцию SSE, истекшая частица заменяется
+// последней, а все живые рисуются одним glDrawArrays. Память выделяет enable()
+// только в потоке с окном; в остальных потоках (оценщик, загрузка уровня) пул
+// пуст и emit ничего не делает.
+const int PARTICLE_CAPACITY = 8192; // Кратно 4
+const float PARTICLE_GRAVITY = 600.0f;
+
+struct ParticleStorage {
+    alignas(16) float x[PARTICLE_CAPACITY];
+    alignas(16) float y[PARTICLE_CAPACITY];
+    alignas(16) float velocityX[PARTICLE_CAPACITY];
+    alignas(16) float velocityY[PARTICLE_CAPACITY];
+    alignas(16) float life[PARTICLE_CAPACITY]; // Оставшееся время, с
+    uint32_t color[PARTICLE_CAPACITY]; // Байты RGBA для glColorPointer
+    alignas(16) float vertices[2 * PARTICLE_CAPACITY]; // Пары x, y для glVertexPointer
+};
+
+struct ParticlePool {
+    std::unique_ptr<ParticleStorage> storage;
+    int count = 0;
+    uint32_t randomState = 2463534242u;
+
+    void enable() {
+        if (!storage)
+            storage.reset(new ParticleStorage());
+        count = 0;
+    }
+
+    bool enabled() const {
+        return storage != nullptr;
+    }
+
+    // Число из [0, 1)
+    float random() {
+        randomState ^= randomState << 13;
+        randomState ^= randomState >> 17;
+        randomState ^= randomState << 5;
+        return (randomState >> 8) * (1.0f / 16777216.0f);
+    }
+
+    // amount частиц в случайных точках прямоугольника со случайной скоростью
+    // до speed по каждой оси. Когда пул полон, лишние частицы не появляются.
+    void emit(float x, float y, float width, float height, int amount, const float rgb[3], float speed, float lifetime) {
+        if (!storage)
+            return;
+        ParticleStorage& p = *storage;
+        const uint8_t bytes[4] = { static_cast<uint8_t>(rgb[0] * 255.0f), static_cast<uint8_t>(rgb[1] * 255.0f),
+            static_cast<uint8_t>(rgb[2] * 255.0f), 255 };
+        uint32_t color;
+        std::memcpy(&color, bytes, sizeof(color));
+        for (int i = 0; i < amount && count < PARTICLE_CAPACITY; i++, count++) {
+            p.x[count] = x + random() * width;
+            p.y[count] = y + random() * height;
+            p.velocityX[count] = (random() * 2.0f - 1.0f) * speed;
+            p.velocityY[count] = (random() * 2.0f - 1.0f) * speed;
+            p.life[count] = lifetime * (0.5f + random() * 0.5f);
+            p.color[count] = color;
+        }
+    }
+
+    void update(float deltaTime) {
+        if (count == 0)
+            return;
+        ParticleStorage& p = *storage;
+        // Хвост до кратного 4 - лишние ячейки массива, их значения не используются
+        const int padded = (count + 3) & ~3;
+#ifdef ARKANOID_SSE
+        const __m128 dt = _mm_set1_ps(deltaTime), fall = _mm_set1_ps(PARTICLE_GRAVITY * deltaTime);
+        for (int i = 0; i < padded; i += 4) {
+            const __m128 velocityY = _mm_add_ps(_mm_load_ps(p.velocityY + i), fall);
+            _mm_store_ps(p.velocityY + i, velocityY);
+            _mm_store_ps(p.x + i, _mm_add_ps(_mm_load_ps(p.x + i), _mm_mul_ps(_mm_load_ps(p.velocityX + i), dt)));
+            _mm_store_ps(p.y + i, _mm_add_ps(_mm_load_ps(p.y + i), _mm_mul_ps(velocityY, dt)));
+            _mm_store_ps(p.life + i, _mm_sub_ps(_mm_load_ps(p.life + i), dt));
+        }
+#else
+        for (int i = 0; i < padded; i++) {
+            p.velocityY[i] += PARTICLE_GRAVITY * deltaTime;
+            p.x[i] += p.velocityX[i] * deltaTime;
+            p.y[i] += p.velocityY[i] * deltaTime;
+            p.life[i] -= deltaTime;
+        }
+#endif
+        // На место истекшей встает последняя, поэтому индекс не сдвигается
+        for (int i = 0; i < count;) {
+            if (p.life[i] > 0.0f) {
+                i++;
+                continue;
+            }
+            count--;
+            p.x[i] = p.x[count];
+            p.y[i] = p.y[count];
+            p.velocityX[i] = p.velocityX[count];
+            p.velocityY[i] = p.velocityY[count];
+            p.life[i] = p.life[count];
+            p.color[i] = p.color[count];
+        }
+    }
+
+    void render() {
+        if (count == 0)
+            return;
+        ParticleStorage& p = *storage;
+        const int padded = (count + 3) & ~3;
+#ifdef ARKANOID_SSE
+        for (int i = 0; i < padded; i += 4) {
+            const __m128 x = _mm_load_ps(p.x + i), y = _mm_load_ps(p.y + i);
+            _mm_store_ps(p.vertices + 2 * i, _mm_unpacklo_ps(x, y));
+            _mm_store_ps(p.vertices + 2 * i + 4, _mm_unpackhi_ps(x, y));
+        }
+#else
+        for (int i = 0; i < padded; i++) {
+            p.vertices[2 * i] = p.x[i];
+            p.vertices[2 * i + 1] = p.y[i];
+        }
+#endif
+        glPointSize(3.0f);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(2, GL_FLOAT, 0, p.vertices);
+        glColorPointer(4, GL_UNSIGNED_BYTE, 0, p.color);
+        glDrawArrays(GL_POINTS, 0, count);
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glPointSize(1.0f);
+    }
+};
+
+thread_local ParticlePool particles;
+
+const float SPARK_COLOR[3] = { 1.0f, 0.9f, 0.5f };
+
+void destroy(int row, int col) {
+    Block block = blockGrid.block(row, col);
+    const BlockTypeInfo& info = blockTypeInfo(block.type);
+    // Уничтожение разрушаемого блока
+    if (!info.indestructible) {
+        block.health--;
+        score += 1;
+        blockGrid.set(row, col, block.type, block.health);
+        if (block.health <= 0) {
+            blockGrid.setAlive(row, col, false);
+        }
+        // Разбитый блок разлетается сильнее поврежденного
+        particles.emit(toFloat(block.x), toFloat(block.y), toFloat(block.width), toFloat(block.height),
+            block.health <= 0 ? 16 : 4, info.color, 150.0f, 0.8f);
+        if (info.ballSpeedFactor != 1.0f) {
+            for (auto& ball : balls) {
+                ball.velocityX *= info.ballSpeedFactor;
+                ball.velocityY *= info.ballSpeedFactor;
+            }
+        }
+        // Создание бонуса
+        if (info.bonusDropChance > 0 && gameRandom() % 100 < info.bonusDropChance) {
+            Bonus bonus;
+            bonus.x = block.x + block.width / 2 - 10.0f;
+            bonus.y = block.y + block.height / 2 - 10.0f;
+            bonus.width = 20.0f;
+            bonus.height = 20.0f;
+            bonus.active = true;
+            bonus.type = randomBonusType();
+            tickCommands.spawnBonuses.push_back(bonus);
+        }
+    }
+}
+
+void updateBall(Ball& ball, Real deltaTime) {
+    ball.x += ball.velocityX * deltaTime;
+    ball.y += ball.velocityY * deltaTime;
+}
+
+// Столкновения шариков друг с другом. Широкая фаза - равномерная сетка с
+// ячейкой в диаметр самого большого шарика: сталкиваться могут только шарики
+// из соседних ячеек. Ячейки нумеруются по строкам, и ballOrder каждый тик
+// досортировывается вставками по номеру ячейки. За тик шарики сдвигаются на пару
+// пикселей, ячейку меняют единицы, и сортировка стоит O(n). Дальше один проход
+// по ballOrder: для шарика проверяются остальные в его ячейке, ячейка справа и
+// три ячейки строкой ниже. Строка ниже идет в ballOrder тоже по возрастанию,
+// поэтому ее начало ищется указателем, который только сдвигается вперед.
+
+// Упругий удар шариков равной массы: составляющие скорости вдоль линии центров
+// меняются местами. Без нормировки: d / |d|^2 умножается на разность скоростей,
+// поэтому не нужен корень и в fixed-point нет переполнения. Шарики без скорости
+// (лежат на платформе) не сталкиваются.
+void collideBallPair(Ball& a, Ball& b) {
+    const Real dx = b.x - a.x, dy = b.y - a.y;
+    const Real reach = a.radius + b.radius;
+    if (realAbs(dy) >= reach)
+        return;
+    const Real distanceSquared = dx * dx + dy * dy;
+    if (distanceSquared >= reach * reach || distanceSquared == 0.0f)
+        return;
+    if ((a.velocityX == 0.0f && a.velocityY == 0.0f) || (b.velocityX == 0.0f && b.velocityY == 0.0f))
+        return;
+    const Real approach = (a.velocityX - b.velocityX) * (dx / distanceSquared) +
+        (a.velocityY - b.velocityY) * (dy / distanceSquared);
+    if (approach <= 0.0f)
+        return; // Уже расходятся
+    a.velocityX -= approach * dx;
+    a.velocityY -= approach * dy;
+    b.velocityX += approach * dx;
+    b.velocityY += approach * dy;
+}
+
+void collideBalls() {
+    const int count = static_cast<int>(balls.size());
+    if (count < 2)
+        return;
+    Real maxRadius = 0.0f, minX = balls[0].x, maxX = balls[0].x, minY = balls[0].y;
+    for (const auto& ball : balls) {
+        maxRadius = std::max(maxRadius, ball.radius);
+        minX = std::min(minX, ball.x);
+        maxX = std::max(maxX, ball.x);
+        minY = std::min(minY, ball.y);
+    }
+    if (maxRadius <= 0.0f)
+        return;
+    // Сетка привязана к началу координат, а номер ячейки отсчитывается от
+    // крайних шариков. Столбцы с запасом в один с каждой стороны: у соседей
+    // слева и справа номер не переходит на другую строку. Порядок номеров не
+    // зависит от крайних шариков, поэтому ballOrder меняется, только когда
+    // шарики переходят из ячейки в ячейку.
+    const Real cellSize = maxRadius * 2.0f;
+    const int firstRow = floorToInt(minY / cellSize), firstColumn = floorToInt(minX / cellSize) - 1;
+    const int64_t columns = floorToInt(maxX / cellSize) - firstColumn + 2;
+
+    // После удаления и появления шариков индексы в ballOrder - по-прежнему
+    // перестановка: лишние выбрасываются, новые добавляются в конец. Ячейки
+    // обновляются на месте, и ballOrder остается почти упорядоченным.
+    if (static_cast<int>(ballOrder.size()) > count)
+        ballOrder.erase(std::remove_if(ballOrder.begin(), ballOrder.end(), [&](const BallCell& entry) { return entry.index >= count; }), ballOrder.end());
+    const int added = count - static_cast<int>(ballOrder.size());
+    for (int i = static_cast<int>(ballOrder.size()); i < count; i++)
+        ballOrder.push_back({ 0, i });
+    for (auto& entry : ballOrder) {
+        const Ball& ball = balls[entry.index];
+        entry.cell = (floorToInt(ball.y / cellSize) - firstRow) * columns + floorToInt(ball.x / cellSize) - firstColumn;
+    }
+
+    // При равных ячейках порядок по индексу: тогда ballOrder зависит только от
+    // текущих шариков, а не от прошлых тиков, и запись воспроизводится.
+    // Если шарики в основном новые (начало уровня), порядка нет и вставки
+    // стоили бы O(n^2).
+    if (added * 2 > count) {
+        std::sort(ballOrder.begin(), ballOrder.end());
+    }
+    else {
+        for (int i = 1; i < count; i++) {
+            const BallCell entry = ballOrder[i];
+            int j = i;
+            for (; j > 0 && entry < ballOrder[j - 1]; j--)
+                ballOrder[j] = ballOrder[j - 1];
+            ballOrder[j] = entry;
+        }
+    }
+
+    int below = 0;
+    for (int i = 0; i < count; i++) {
+        Ball& first = balls[ballOrder[i].index];
+        const int64_t cell = ballOrder[i].cell;
+        for (int j = i + 1; j < count && ballOrder[j].cell <= cell + 1; j++)
+            collideBallPair(first, balls[ballOrder[j].index]);
+        const int64_t belowFirst = cell + columns - 1, belowLast = cell + columns + 1;
+        while (below < count && ballOrder[below].cell < belowFirst)
+            below++;
+        for (int j = below; j < count && ballOrder[j].cell <= belowLast; j++)
+            collideBallPair(first, balls[ballOrder[j].index]);
+    }
+}
+
+// Применяет накопленные за тик структурные изменения
+void applyTickCommands() {
+    if (tickCommands.restartLevel) {
+        tickCommands.clear();
+        if (restartOnLevelEnd) {
+            std::cout << "Game Over! Your score: " << score << std::endl;
+            initGame();
+        }
+        else {
+            levelEnded = true;
+        }
+        return;
+    }
+
+    // Удаляем с больших индексов: перенос последнего элемента на место
+    // удаленного не задевает еще не обработанные индексы
+    std::sort(tickCommands.despawnBalls.begin(), tickCommands.despawnBalls.end(), std::greater<int>());
+    for (int index : tickCommands.despawnBalls) {
+        balls[index] = balls.back();
+        balls.pop_back();
+    }
+    std::sort(tickCommands.despawnBonuses.begin(), tickCommands.despawnBonuses.end(), std::greater<int>());
+    for (int index : tickCommands.despawnBonuses) {
+        bonuses.removeAt(index);
+    }
+
+    for (const auto& newBall : tickCommands.spawnBalls) {
+        balls.push_back(newBall);
+    }
+    for (const auto& newBonus : tickCommands.spawnBonuses) {
+        if (Bonus* bonus = bonuses.spawn()) {
+            bonus->x = newBonus.x;
+            bonus->y = newBonus.y;
+            bonus->width = newBonus.width;
+            bonus->height = newBonus.height;
+            bonus->type = newBonus.type;
+        }
+    }
+    tickCommands.clear();
+}
+
+// Попадание шарика в блок за тик
+struct BlockDamage {
+    int ball; // индекс в balls
+    int row, col;
+    int contact; // номер касания шарика за тик
+};
+
+// Касаний блоков одним шариком за тик. Больше бывает только в щелях между
+// блоками, там шарик доходит до последнего касания и ждет следующего тика.
+const int MAX_BLOCK_CONTACTS = 4;
+
+// Что собирает один поток за обход шариков. Все это меняет общее состояние
+// (поле, счет, жизни, липкость), поэтому применяется после обхода.
+struct BallStepBuffer {
+    std::vector<BlockDamage> damage;
+    std::vector<int> fallen; // шарики, упавшие ниже поля
+    std::vector<int> paddleHits; // шарики, отскочившие от платформы (для искр)
+    int stuck = 0; // шарики, лежащие на липкой платформе
+
+    void reserve(size_t maxBalls) {
+        damage.reserve(maxBalls * MAX_BLOCK_CONTACTS);
+        fallen.reserve(maxBalls);
+        paddleHits.reserve(maxBalls);
+    }
+
+    void clear() {
+        damage.clear();
+        fallen.clear();
+        paddleHits.clear();
+        stuck = 0;
+    }
+};
+
+// Неизменное за обход шариков окружение. Передается явно: рабочие потоки
+// не видят thread_local состояние игры.
+struct BallStepContext {
+    const BlockGrid* grid;
+    Paddle paddle;
+    bool stickyBall;
+    Real rightWall, bottomWall;
+    Real deltaTime;
+};
+
+// Ход одного шарика за тик. Читает только сам шарик и context, пишет только
+// в шарик и out, поэтому шарики можно обходить в любом порядке и в любых потоках.
+void stepBall(Ball& ball, int ballIndex, const BallStepContext& context, BallStepBuffer& out) {
+    const Real deltaTime = context.deltaTime;
+    const Real startX = ball.x, startY = ball.y;
+    // Обновление позиции шарика
+    if (checkCollision(ball, context.paddle) && context.stickyBall && ball.velocityX != 0 && ball.velocityY != 0) {
+        out.stuck++;
+        return;
+    }
+    else {
+        updateBall(ball, deltaTime);
+    }
+
+    // Обработка столкновений со стенами
+    if (ball.x < 0.0f || ball.x + ball.radius > context.rightWall) {
+        ball.velocityX = -ball.velocityX;
+        updateBall(ball, deltaTime);
+    }
+    else if (ball.y < 0.0f) {
+        ball.velocityY = -ball.velocityY;
+        updateBall(ball, deltaTime);
+    }
+
+    // Обработка столкновения с платформой
+    if (checkCollision(ball, context.paddle)) {
+        ball.velocityY = -ball.velocityY;
+        ball.y = context.paddle.y - ball.radius;
+        out.paddleHits.push_back(ballIndex);
+    }
+
+    // Обработка столкновений с блоками: обходятся только клетки вдоль пути
+    // шарика за тик. Шарик останавливается у первого живого блока, отражается,
+    // и остаток пути проверяется заново - не больше MAX_BLOCK_CONTACTS касаний
+    // за тик, после последнего шарик остается в точке касания. Поле за обход
+    // не меняется, блоки разрушаются потом.
+    BlockHit hit;
+    Real fromX = startX, fromY = startY, remaining = deltaTime;
+    Real pathX = ball.x - startX, pathY = ball.y - startY;
+    for (int contacts = 0; context.grid->firstHit(fromX, fromY, pathX, pathY, ball.radius, hit); ) {
+        fromX += pathX * hit.t + hit.pushX;
+        fromY += pathY * hit.t + hit.pushY;
+        if (hit.flipX)
+            ball.velocityX = -ball.velocityX;
+        if (hit.flipY)
+            ball.velocityY = -ball.velocityY;
+        out.damage.push_back({ ballIndex, hit.row, hit.col, contacts });
+        remaining *= 1 - hit.t;
+        pathX = ball.velocityX * remaining;
+        pathY = ball.velocityY * remaining;
+        if (++contacts == MAX_BLOCK_CONTACTS) {
+            pathX = pathY = 0.0f;
+            break;
+        }
+    }
+    ball.x = fromX + pathX;
+    ball.y = fromY + pathY;
+
+    if (ball.y >= context.bottomWall)
+        out.fallen.push_back(ballIndex);
+}
+
+// Событийный режим для партий без окна (playLayout). Между касаниями шарик
+// летит по прямой, поэтому заранее известно, сколько тиков подряд у него не
+// будет касаний стен, платформы и блоков. Эти тики шарик только сдвигается, а
+// полный stepBall идет на первом тике, где касание возможно. Платформа, бонусы,
+// удары шариков друг о друга и прокрутка поля по-прежнему считаются каждый тик,
+// поэтому партия до бита совпадает с обычным updateGame (--check-events).
+// Вместо очереди событий у каждого шарика свой счетчик тиков до события: шарики
+// все равно сдвигаются каждый тик, и очередь ничего бы не сэкономила.
+const int EVENT_HORIZON_TICKS = 120;
+// Запас до препятствий в пикселях: покрывает ошибку округления позиции за
+// EVENT_HORIZON_TICKS тиков на полях шириной до ~100 тысяч пикселей
+const Real EVENT_MARGIN = 2.0f;
+
+// Расписание шарика годно, пока шарик такой же, каким его оставил прошлый
+// ход (иначе его изменил удар о другой шарик, бонус или удаление соседа),
+// блоки на его пути не менялись, а длина тика и границы поля те же.
+struct BallSchedule {
+    bool enabled = false;
+    std::vector<Ball> expected; // Шарик после прошлого хода
+    std::vector<int> quietTicks; // Тиков без касаний, начиная со следующего
+    uint32_t gridRevision = 0;
+    Real deltaTime = 0.0f, rightWall = 0.0f, paddleY = 0.0f;
+
+    void reserve(size_t maxBalls) {
+        expected.reserve(maxBalls);
+        quietTicks.reserve(maxBalls);
+    }
+};
+
+thread_local BallSchedule ballSchedule;
+
+bool sameBall(const Ball& a, const Ball& b) {
+    return a.x == b.x && a.y == b.y && a.radius == b.radius && a.velocityX == b.velocityX && a.velocityY == b.velocityY;
+}
+
+// Сколько тиков подряд, начиная со следующего, ход шарика заведомо обходится без
+// касаний: шарик держится на EVENT_MARGIN от стен, линии платформы и блоков
+int countQuietTicks(const Ball& ball, const BallStepContext& context) {
+    const Real margin = EVENT_MARGIN, radius = ball.radius;
+    if (ball.y + radius >= context.paddle.y - margin)
+        return 0;
+    const Real stepX = ball.velocityX * context.deltaTime, stepY = ball.velocityY * context.deltaTime;
+    // Тиков, за которые шарик, проходя step за тик, не пройдет distance
+    auto ticksWithin = [](Real distance, Real step) {
+        if (distance < 0.0f)
+            return 0;
+        if (step <= 0.0f || distance >= step * EVENT_HORIZON_TICKS)
+            return EVENT_HORIZON_TICKS;
+        return floorToInt(distance / step);
+    };
+    int ticks = EVENT_HORIZON_TICKS;
+    ticks = std::min(ticks, ticksWithin(ball.x - margin, -stepX));
+    ticks = std::min(ticks, ticksWithin(context.rightWall - margin - radius - ball.x, stepX));
+    ticks = std::min(ticks, ticksWithin(ball.y - margin, -stepY));
+    ticks = std::min(ticks, ticksWithin(context.paddle.y - margin - radius - ball.y, stepY));
+    if (ticks == 0)
+        return 0;
+
+    // Шарик уже у блока: касание решает stepBall
+    const Real reach = radius + margin;
+    int rowBegin, rowEnd, colBegin, colEnd;
+    context.grid->cellRange(ball.x - reach, ball.y - reach, ball.x + reach, ball.y + reach, rowBegin, rowEnd, colBegin, colEnd);
+    bool nearBlock = false;
+    context.grid->forEachAlive(rowBegin, rowEnd, colBegin, colEnd, [&](int row, int col) {
+        nearBlock = nearBlock || (ball.x + reach >= col * BLOCK_STEP_X && ball.x - reach <= col * BLOCK_STEP_X + BLOCK_WIDTH &&
+            ball.y + reach >= row * BLOCK_STEP_Y && ball.y - reach <= row * BLOCK_STEP_Y + BLOCK_HEIGHT);
+    });
+    if (nearBlock)
+        return 0;
+    BlockHit hit = {};
+    if (context.grid->firstHit(ball.x, ball.y, stepX * ticks, stepY * ticks, reach, hit))
+        ticks = std::max(0, floorToInt(hit.t * ticks) - 1);
+    return ticks;
+}
+
+// Ход шарика в событийном режиме. Тихий тик повторяет арифметику stepBall без
+// касаний, поэтому позиция совпадает с обычным ходом до бита.
+void stepScheduledBall(Ball& ball, int ballIndex, const BallStepContext& context, BallStepBuffer& out,
+    Ball& expected, int& quietTicks) {
+    if (quietTicks > 0 && sameBall(ball, expected)) {
+        const Real startX = ball.x, startY = ball.y;
+        updateBall(ball, context.deltaTime);
+        ball.x = startX + (ball.x - startX);
+        ball.y = startY + (ball.y - startY);
+        quietTicks--;
+    }
+    else {
+        stepBall(ball, ballIndex, context, out);
+        quietTicks = countQuietTicks(ball, context);
+    }
+    expected = ball;
+}
+
+// Перед обходом: сбрасывает расписания, которым больше нельзя верить
+void refreshBallSchedule(const BallStepContext& context) {
+    BallSchedule& schedule = ballSchedule;
+    const size_t count = balls.size();
+    if (schedule.deltaTime != context.deltaTime || schedule.rightWall != context.rightWall || schedule.paddleY != context.paddle.y) {
+        schedule.deltaTime = context.deltaTime;
+        schedule.rightWall = context.rightWall;
+        schedule.paddleY = context.paddle.y;
+        schedule.quietTicks.assign(schedule.quietTicks.size(), 0);
+    }
+    schedule.expected.resize(count);
+    schedule.quietTicks.resize(count, 0);
+    if (schedule.gridRevision == context.grid->revision)
+        return;
+    for (size_t i = 0; i < count; i++) {
+        const int ticks = schedule.quietTicks[i];
+        if (ticks == 0)
+            continue;
+        const Ball& ball = schedule.expected[i];
+        const Real endX = ball.x + ball.velocityX * context.deltaTime * ticks;
+        const Real endY = ball.y + ball.velocityY * context.deltaTime * ticks;
+        if (context.grid->changedSince(schedule.gridRevision, ball.radius + EVENT_MARGIN,
+            std::min(ball.x, endX), std::min(ball.y, endY), std::max(ball.x, endX), std::max(ball.y, endY)))
+            schedule.quietTicks[i] = 0;
+    }
+    schedule.gridRevision = context.grid->revision;
+}
+
+// Постоянные рабочие потоки: создавать потоки каждый тик дороже самого обхода.
+// Между запусками потоки спят на condition_variable. run(task) вызывает task(worker)
+// во всех потоках, включая вызывающий (worker 0), и ждет, пока все не закончат.
+struct WorkerPool {
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake, finished;
+    std::function<void(int)> task;
+    uint64_t generation = 0;
+    int running = 0;
+    bool stopping = false;
+
+    int size() const {
+        return static_cast<int>(threads.size()) + 1;
+    }
+
+    void resize(int count) {
+        if (count == size())
+            return;
+        stop();
+        // Новые потоки ждут следующего запуска, а не уже выполненных
+        const uint64_t current = generation;
+        for (int worker = 1; worker < count; worker++)
+            threads.emplace_back([this, worker, current] { loop(worker, current); });
+    }
+
+    void loop(int worker, uint64_t seen) {
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+            }
+            task(worker);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--running == 0)
+                finished.notify_one();
+        }
+    }
+
+    // std::ref не дает std::function копировать task и выделять память
+    template <typename Task>
+    void run(Task& work) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = std::ref(work);
+            running = static_cast<int>(threads.size());
+            generation++;
+        }
+        wake.notify_all();
+        work(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&] { return running == 0; });
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads)
+            thread.join();
+        threads.clear();
+        stopping = false;
+    }
+
+    ~WorkerPool() {
+        stop();
+    }
+};
+
+// Потоков для обхода шариков (--ball-threads), 0 - по числу ядер. Обход делится
+// только начиная с PARALLEL_BALLS_MIN шариков: на меньшем числе синхронизация
+// дороже выигрыша. Результат тика от числа потоков не зависит.
+int ballThreads = 0;
+const int PARALLEL_BALLS_MIN = 2048;
+const int BALL_CHUNK_SIZE = 256;
+thread_local WorkerPool ballWorkers;
+thread_local std::vector<BallStepBuffer> ballStepBuffers(1);
+
+int ballThreadCount() {
+    return ballThreads > 0 ? ballThreads : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+// Вызывается при загрузке уровня: потоки и буферы готовятся заранее, чтобы
+// кадр не выделял память. Все записи за тик помещаются в ballStepBuffers[0].
+void reserveBallSteps() {
+    if (balls.capacity() >= static_cast<size_t>(PARALLEL_BALLS_MIN) && ballThreadCount() > 1) {
+        ballWorkers.resize(ballThreadCount());
+        ballStepBuffers.resize(ballWorkers.size());
+    }
+    for (auto& buffer : ballStepBuffers)
+        buffer.reserve(balls.capacity());
+    ballSchedule.reserve(balls.capacity());
+}
+
+// Обходит все шарики. Потоки разбирают куски по BALL_CHUNK_SIZE шариков, поэтому
+// записи в буферах потоков идут вперемешку. Они сливаются в ballStepBuffers[0] и
+// сортируются по номеру шарика - порядок тот же, что при обходе в одном потоке.
+const BallStepBuffer& stepBalls(const BallStepContext& context) {
+    const int count = static_cast<int>(balls.size());
+    const bool parallel = count >= PARALLEL_BALLS_MIN && ballThreadCount() > 1;
+    if (parallel && ballWorkers.size() != ballThreadCount())
+        reserveBallSteps();
+    BallStepBuffer& merged = ballStepBuffers[0];
+    merged.clear();
+    const bool events = ballSchedule.enabled;
+    if (events)
+        refreshBallSchedule(context);
+    if (!parallel) {
+        for (int ballIndex = 0; ballIndex < count; ballIndex++) {
+            if (events)
+                stepScheduledBall(balls[ballIndex], ballIndex, context, merged,
+                    ballSchedule.expected[ballIndex], ballSchedule.quietTicks[ballIndex]);
+            else
+                stepBall(balls[ballIndex], ballIndex, context, merged);
+        }
+        return merged;
+    }
+
+    // thread_local в рабочих потоках свои, поэтому в задачу идут указатели
+    Ball* data = balls.data();
+    BallStepBuffer* buffers = ballStepBuffers.data();
+    Ball* expected = ballSchedule.expected.data();
+    int* quietTicks = ballSchedule.quietTicks.data();
+    std::atomic<int> nextChunk(0);
+    auto work = [&](int worker) {
+        BallStepBuffer& out = buffers[worker];
+        for (int begin = nextChunk++ * BALL_CHUNK_SIZE; begin < count; begin = nextChunk++ * BALL_CHUNK_SIZE) {
+            const int end = std::min(begin + BALL_CHUNK_SIZE, count);
+            for (int ballIndex = begin; ballIndex < end; ballIndex++) {
+                if (events)
+                    stepScheduledBall(data[ballIndex], ballIndex, context, out, expected[ballIndex], quietTicks[ballIndex]);
+                else
+                    stepBall(data[ballIndex], ballIndex, context, out);
+            }
+        }
+    };
+    ballWorkers.run(work);
+
+    for (int worker = 1; worker < ballWorkers.size(); worker++) {
+        BallStepBuffer& buffer = buffers[worker];
+        merged.damage.insert(merged.damage.end(), buffer.damage.begin(), buffer.damage.end());
+        merged.fallen.insert(merged.fallen.end(), buffer.fallen.begin(), buffer.fallen.end());
+        merged.paddleHits.insert(merged.paddleHits.end(), buffer.paddleHits.begin(), buffer.paddleHits.end());
+        merged.stuck += buffer.stuck;
+        buffer.clear();
+    }
+    std::sort(merged.damage.begin(), merged.damage.end(), [](const BlockDamage& a, const BlockDamage& b) {
+        return a.ball != b.ball ? a.ball < b.ball : a.contact < b.contact;
+    });
+    std::sort(merged.fallen.begin(), merged.fallen.end());
+    // paddleHits нужны только искрам, их порядок на игру не влияет
+    return merged;
+}
+
+void updateGame(Real deltaTime) {
+    const Real rightWall = fieldWidth(), bottomWall = fieldHeight();
+    advanceBonusEffects(deltaTime);
+    const BallStepContext context = { &blockGrid, paddle, stickyBall, rightWall, bottomWall, deltaTime };
+    const BallStepBuffer& steps = stepBalls(context);
+
+    // Итоги обхода применяются в порядке номеров шариков
+    if (steps.stuck > 0) {
+        stickyWait += steps.stuck;
+        if (stickyWait > 8) {
+            stickyBall = false;
+            stickyWait = 0;
+        }
+    }
+    for (const BlockDamage& damage : steps.damage) {
+        // Два шарика могли попасть в один блок за тик: отражаются оба, а
+        // блок, уже разрушенный шариком с меньшим номером, второй раз не бьется
+        if (blockGrid.isAlive(damage.row, damage.col))
+            destroy(damage.row, damage.col);
+    }
+    for (int ballIndex : steps.paddleHits) {
+        const Ball& ball = balls[ballIndex];
+        particles.emit(toFloat(ball.x - ball.radius), toFloat(paddle.y), toFloat(ball.radius * 2), 0.0f, 6, SPARK_COLOR, 250.0f, 0.3f);
+    }
+    for (int ballIndex : steps.fallen) {
+        Ball& ball = balls[ballIndex];
+        if (oneTimeBottom) {
+            oneTimeBottom = false;
+            ball.velocityY = -ball.velocityY;
+        }
+        else if (balls.size() - tickCommands.despawnBalls.size() > 1) {
+            tickCommands.despawnBalls.push_back(ballIndex);
+        }
+        else {
+            lives--;
+            if (lives <= 0) {
+                tickCommands.restartLevel = true;
+            }
+            else {
+                startFlag = true;
+                stickyBall = true;
+                ball.x = paddle.x + paddle.width / 2;
+                ball.y = paddle.y - 10.0f;
+                ball.velocityX = 0.0f;
+                ball.velocityY = 0.0f;
+            }
+        }
+    }
+
+    collideBalls();
+
+    // В бесконечном режиме поле не кончается: пустое поле заполнят новые строки
+    if (endless.enabled)
+        advanceEndless(deltaTime);
+    else if (!tickCommands.restartLevel && isBoardCleared())
+        tickCommands.restartLevel = true;
+
+    // Обновление бонусов: пойманные и упавшие возвращаются в пул в конце тика
+    for (int i = 0; i < bonuses.size(); i++) {
+        Bonus& bonus = bonuses[i];
+        bonus.y += BONUS_FALL_SPEED * deltaTime;
+
+        if (checkCollision(paddle, bonus)) {
+            applyBonus(bonus.type);
+            tickCommands.despawnBonuses.push_back(i);
+        }
+        else if (bonus.y > bottomWall) {
+            tickCommands.despawnBonuses.push_back(i);
+        }
+    }
+
+    applyTickCommands();
+    particles.update(toFloat(deltaTime));
+}
+
+// Хэш всего состояния игры. Поле входит готовым хэшем Зобриста из blockGrid,
+// который обновляется только при изменении клеток, остальное (платформа, шарики,
+// бонусы, счет и флаги) меняется каждый тик и подмешивается целиком.
+uint64_t hashGameState() {
+    uint64_t hash = mixHash(blockGrid.hash);
+    auto mix = [&](uint64_t value) {
+        hash = mixHash(hash ^ value);
+    };
+    mix(realBits(paddle.x));
+    mix(realBits(paddle.width));
+    for (const auto& b : balls) {
+        mix((static_cast<uint64_t>(realBits(b.x)) << 32) | realBits(b.y));
+        mix((static_cast<uint64_t>(realBits(b.velocityX)) << 32) | realBits(b.velocityY));
+        mix(realBits(b.radius));
+    }
+    for (int i = 0; i < bonuses.size(); i++) {
+        const Bonus& bonus = bonuses[i];
+        mix((static_cast<uint64_t>(realBits(bonus.x)) << 32) | realBits(bonus.y));
+        mix(bonus.type);
+    }
+    mix((static_cast<uint64_t>(static_cast<uint32_t>(score)) << 32) | static_cast<uint32_t>(lives));
+    mix(static_cast<uint64_t>(stickyWait) << 8 | stickyBall << 2 | oneTimeBottom << 1 | startFlag);
+    if (endless.enabled)
+        mix(static_cast<uint64_t>(blockGrid.rowOffset) << 32 | realBits(endless.rowTimer));
+    mix(static_cast<uint64_t>(bonusEffects.now) << 32 | realBits(bonusEffects.clock));
+    mix(bonusEffects.digest);
+    return hash;
+}
+
+// Запись игры: зерно генератора, ввод и длительность каждого тика и хэш
+// состояния после него. Воспроизведение повторяет тики и сравнивает хэши.
+struct ReplayFrame {
+    Real paddleX;
+    bool launch;
+    Real deltaTime;
+    uint64_t hash;
+};
+
+struct Replay {
+    uint32_t seed = 0;
+    std::vector<ReplayFrame> frames;
+    std::vector<uint8_t> layoutAttempts; // См. LevelPreloader::attempts
+};
+
+const char REPLAY_MAGIC[4] = { 'A', 'R', 'K', 'R' };
+// Записи float- и fixed-point-сборок несовместимы
+#ifdef ARKANOID_FIXED_POINT
+const uint8_t REPLAY_REAL_KIND = 1;
+#else
+const uint8_t REPLAY_REAL_KIND = 0;
+#endif
+
+bool saveReplay(const Replay& replay, const char* path) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "Failed to write replay " << path << std::endl;
+        return false;
+    }
+    const uint32_t numFrames = static_cast<uint32_t>(replay.frames.size());
+    file.write(REPLAY_MAGIC, sizeof(REPLAY_MAGIC));
+    file.write(reinterpret_cast<const char*>(&REPLAY_REAL_KIND), sizeof(REPLAY_REAL_KIND));
+    file.write(reinterpret_cast<const char*>(&replay.seed), sizeof(replay.seed));
+    file.write(reinterpret_cast<const char*>(&numFrames), sizeof(numFrames));
+    for (const auto& frame : replay.frames) {
+        const uint8_t launch = frame.launch;
+        file.write(reinterpret_cast<const char*>(&frame.paddleX), sizeof(frame.paddleX));
+        file.write(reinterpret_cast<const char*>(&launch), sizeof(launch));
+        file.write(reinterpret_cast<const char*>(&frame.deltaTime), sizeof(frame.deltaTime));
+        file.write(reinterpret_cast<const char*>(&frame.hash), sizeof(frame.hash));
+    }
+    const uint32_t numAttempts = static_cast<uint32_t>(replay.layoutAttempts.size());
+    file.write(reinterpret_cast<const char*>(&numAttempts), sizeof(numAttempts));
+    file.write(reinterpret_cast<const char*>(replay.layoutAttempts.data()), numAttempts);
+    return static_cast<bool>(file);
+}
+
+bool loadReplay(Replay& replay, const char* path) {
+    std::ifstream file(path, std::ios::binary);
+    char magic[sizeof(REPLAY_MAGIC)];
+    uint8_t realKind = 0;
+    uint32_t numFrames = 0;
+    if (!file.read(magic, sizeof(magic)) || std::memcmp(magic, REPLAY_MAGIC, sizeof(magic)) != 0 ||
+        !file.read(reinterpret_cast<char*>(&realKind), sizeof(realKind)) || realKind != REPLAY_REAL_KIND ||
+        !file.read(reinterpret_cast<char*>(&replay.seed), sizeof(replay.seed)) ||
+        !file.read(reinterpret_cast<char*>(&numFrames), sizeof(numFrames))) {
+        std::cerr << "Invalid replay " << path << std::endl;
+        return false;
+    }
+    replay.frames.clear();
+    for (uint32_t i = 0; i < numFrames; i++) {
+        ReplayFrame frame;
+        uint8_t launch = 0;
+        file.read(reinterpret_cast<char*>(&frame.paddleX), sizeof(frame.paddleX));
+        file.read(reinterpret_cast<char*>(&launch), sizeof(launch));
+        file.read(reinterpret_cast<char*>(&frame.deltaTime), sizeof(frame.deltaTime));
+        file.read(reinterpret_cast<char*>(&frame.hash), sizeof(frame.hash));
+        if (!file) {
+            std::cerr << "Truncated replay " << path << std::endl;
+            return false;
+        }
+        frame.launch = launch != 0;
+        replay.frames.push_back(frame);
+    }
+    // В записях старого формата номеров раскладок нет
+    uint32_t numAttempts = 0;
+    replay.layoutAttempts.clear();
+    if (file.read(reinterpret_cast<char*>(&numAttempts), sizeof(numAttempts))) {
+        replay.layoutAttempts.resize(numAttempts);
+        if (!file.read(reinterpret_cast<char*>(replay.layoutAttempts.data()), numAttempts)) {
+            std::cerr << "Truncated replay " << path << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Первый тик, на котором потоки хэшей расходятся, или -1. Разошедшееся
+// состояние дальше не сходится, поэтому хватает двоичного поиска по потоку.
+int firstDivergentTick(const std::vector<uint64_t>& a, const std::vector<uint64_t>& b) {
+    const int count = static_cast<int>(std::min(a.size(), b.size()));
+    if (count == 0 || a[count - 1] == b[count - 1])
+        return a.size() == b.size() ? -1 : count;
+    int low = 0, high = count - 1; // a[high] != b[high]
+    while (low < high) {
+        const int middle = low + (high - low) / 2;
+        if (a[middle] == b[middle])
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+std::vector<uint64_t> replayHashes(const Replay& replay) {
+    std::vector<uint64_t> hashes;
+    hashes.reserve(replay.frames.size());
+    for (const auto& frame : replay.frames)
+        hashes.push_back(frame.hash);
+    return hashes;
+}
+
+// Повторяет запись без окна и возвращает хэши состояния после каждого тика
+std::vector<uint64_t> playReplay(const Replay& replay) {
+    seedSession(replay.seed);
+    levelPreloader.replay(replay.layoutAttempts);
+    initGame();
+    std::vector<uint64_t> hashes;
+    hashes.reserve(replay.frames.size());
+    for (const auto& frame : replay.frames) {
+        applyInput({ frame.paddleX, frame.launch });
+        updateGame(frame.deltaTime);
+        hashes.push_back(hashGameState());
+    }
+    return hashes;
+}
+
+// Предсказание пути шарика до линии платформы с отскоками от стен и блоков.
+// Путь - ломаная из отрезков равномерного движения, блоки на пути ищет
+// BlockGrid::firstHit. Путь кэшируется для каждого шарика: пока шарик идет по
+// одному из отрезков с той же скоростью и поле на оставшемся пути не менялось,
+// запрос отвечается из кэша. Нужен подсказке прицела и автопилоту.
+const int MAX_PATH_SEGMENTS = 16;
+
+struct PathSegment {
+    Real x, y;
+    Real velocityX, velocityY;
+    Real duration;
+
+    Real endX() const { return x + velocityX * duration; }
+    Real endY() const { return y + velocityY * duration; }
+};
+
+struct TrajectoryPrediction {
+    PathSegment segments[MAX_PATH_SEGMENTS];
+    int numSegments = 0;
+    bool valid = false;
+    bool reachesPaddle = false; // false: шарик уже ниже платформы, стоит или путь длиннее MAX_PATH_SEGMENTS
+    Real paddleX = 0.0f;        // x центра шарика на линии платформы
+    Real radius = 0.0f;
+    uint32_t gridRevision = 0;
+};
+
+thread_local std::vector<TrajectoryPrediction> trajectoryCache;
+thread_local long long trajectoryCacheHits = 0;
+thread_local long long trajectoryCacheMisses = 0;
+
+// Вызывается из reserveForLevel: запись кэша есть у каждого шарика, сколько бы
+// их ни стало за уровень, поэтому кадр кэш не растит
+void reserveTrajectories() {
+    trajectoryCache.assign(balls.capacity(), TrajectoryPrediction());
+}
+
+// Строит путь шарика заново. Блоки на пути считаются неподвижными: после их
+// разрушения путь пересчитается по журналу изменений поля.
+void computeTrajectory(const Ball& ball, TrajectoryPrediction& path) {
+    path.numSegments = 0;
+    path.valid = true;
+    path.reachesPaddle = false;
+    path.radius = ball.radius;
+    path.gridRevision = blockGrid.revision;
+    if (ball.y + ball.radius > paddle.y || (ball.velocityX == 0.0f && ball.velocityY == 0.0f))
+        return;
+
+    const Real infinity = realInfinity();
+    Real x = ball.x, y = ball.y, velocityX = ball.velocityX, velocityY = ball.velocityY;
+    while (path.numSegments < MAX_PATH_SEGMENTS) {
+        // Стены и линия платформы - с теми же границами, что в updateGame
+        Real sideTime = infinity, verticalTime = infinity;
+        if (velocityX < 0.0f)
+            sideTime = std::max(Real(0), -x / velocityX);
+        else if (velocityX > 0.0f)
+            sideTime = std::max(Real(0), (fieldWidth() - ball.radius - x) / velocityX);
+        if (velocityY < 0.0f)
+            verticalTime = std::max(Real(0), -y / velocityY);
+        else if (velocityY > 0.0f)
+            verticalTime = (paddle.y - ball.radius - y) / velocityY;
+
+        Real duration = std::min(sideTime, verticalTime);
+        bool flipX = sideTime <= duration;
+        bool flipY = velocityY < 0.0f && verticalTime <= duration;
+        bool atPaddle = velocityY > 0.0f && verticalTime <= duration;
+
+        BlockHit hit = {};
+        if (blockGrid.firstHit(x, y, (velocityX * duration), (velocityY * duration),
+            ball.radius, hit)) {
+            duration *= hit.t;
+            flipX = hit.flipX;
+            flipY = hit.flipY;
+            atPaddle = false;
+        }
+
+        PathSegment& segment = path.segments[path.numSegments++];
+        segment = { x, y, velocityX, velocityY, (duration) };
+        x = segment.endX() + hit.pushX;
+        y = segment.endY() + hit.pushY;
+        if (atPaddle) {
+            path.reachesPaddle = true;
+            path.paddleX = x;
+            return;
+        }
+        if (flipX)
+            velocityX = -velocityX;
+        if (flipY)
+            velocityY = -velocityY;
+    }
+}
+
+// Номер отрезка пути, по которому сейчас идет шарик, или -1
+int locateOnPath(const TrajectoryPrediction& path, const Ball& ball) {
+    // Пустой путь верен, пока шарик стоит или остается ниже платформы
+    if (path.numSegments == 0)
+        return ball.y + ball.radius > paddle.y || (ball.velocityX == 0.0f && ball.velocityY == 0.0f) ? 0 : -1;
+    // Время вдоль отрезка берется по оси, где скорость больше, отклонение от
+    // прямой - по другой оси. Без квадратов скоростей расчет помещается в Q16.16.
+    const Real tolerance = 1.0f, timeSlack = 0.01f;
+    for (int i = 0; i < path.numSegments; i++) {
+        const PathSegment& segment = path.segments[i];
+        if (segment.velocityX != ball.velocityX || segment.velocityY != ball.velocityY)
+            continue;
+        const Real offsetX = ball.x - segment.x, offsetY = ball.y - segment.y;
+        Real along, across;
+        if (realAbs(segment.velocityX) >= realAbs(segment.velocityY)) {
+            along = offsetX / segment.velocityX;
+            across = offsetY - segment.velocityY * along;
+        }
+        else {
+            along = offsetY / segment.velocityY;
+            across = offsetX - segment.velocityX * along;
+        }
+        if (realAbs(across) <= tolerance && along >= -timeSlack && along <= segment.duration + timeSlack)
+            return i;
+    }
+    return -1;
+}
+
+// Задел ли какой-нибудь отрезок пути, начиная с first, измененные с прошлой проверки клетки
+bool isPathStale(TrajectoryPrediction& path, int first) {
+    if (path.gridRevision == blockGrid.revision)
+        return false;
+    for (int i = first; i < path.numSegments; i++) {
+        const PathSegment& segment = path.segments[i];
+        if (blockGrid.changedSince(path.gridRevision, path.radius,
+            std::min(segment.x, segment.endX()), std::min(segment.y, segment.endY()),
+            std::max(segment.x, segment.endX()), std::max(segment.y, segment.endY())))
+            return true;
+    }
+    path.gridRevision = blockGrid.revision;
+    return false;
+}
+
+// Путь шарика balls[ballIndex]; в segmentIndex - отрезок, на котором шарик сейчас
+const TrajectoryPrediction& predictTrajectory(int ballIndex, int& segmentIndex) {
+    const Ball& ball = balls[ballIndex];
+    // Новые ряды бесконечного режима дают удары сверх резерва уровня, а с ними
+    // и шарики из бонусов; тогда кэш растет вслед за balls
+    if (static_cast<size_t>(ballIndex) >= trajectoryCache.size())
+        reserveTrajectories();
+    TrajectoryPrediction& path = trajectoryCache[ballIndex];
+
+    segmentIndex = path.valid ? locateOnPath(path, ball) : -1;
+    if (segmentIndex < 0 || isPathStale(path, segmentIndex)) {
+        computeTrajectory(ball, path);
+        segmentIndex = 0;
+        trajectoryCacheMisses++;
+    }
+    else {
+        trajectoryCacheHits++;
+    }
+    return path;
+}
+
+// Где шарик пересечет линию платформы; false, если не пересечет
+bool predictPaddleCrossing(int ballIndex, Real& crossX, Real& timeLeft) {
+    int segmentIndex;
+    const TrajectoryPrediction& path = predictTrajectory(ballIndex, segmentIndex);
+    if (!path.reachesPaddle)
+        return false;
+    const Ball& ball = balls[ballIndex];
+    const PathSegment& current = path.segments[segmentIndex];
+    // Пройденное по отрезку время - по оси, вдоль которой шарик движется быстрее
+    if (realAbs(current.velocityX) > realAbs(current.velocityY))
+        timeLeft = current.duration - (ball.x - current.x) / current.velocityX;
+    else
+        timeLeft = current.duration - (ball.y - current.y) / current.velocityY;
+    for (int i = segmentIndex + 1; i < path.numSegments; i++)
+        timeLeft += path.segments[i].duration;
+    crossX = path.paddleX;
+    return true;
+}
+
+// Автопилот: платформа идет под шарик, который раньше всех долетит до нее
+Real autopilotPaddleX(Real deltaTime) {
+    Real bestTime = realInfinity();
+    Real targetX = paddle.x;
+    for (int i = 0; i < static_cast<int>(balls.size()); i++) {
+        Real crossX, timeLeft;
+        if (predictPaddleCrossing(i, crossX, timeLeft) && timeLeft < bestTime) {
+            bestTime = timeLeft;
+            targetX = crossX - paddle.width / 2.0f;
+        }
+    }
+    const Real maxStep = paddle.speed * deltaTime;
+    return paddle.x + std::max(-maxStep, std::min(maxStep, targetX - paddle.x));
+}
+
+// Оценка сложности раскладки: много партий без окна с автопилотом вместо игрока
+// на всех ядрах. Партия определяется раскладкой и номером, поэтому результат не
+// зависит от числа потоков. Оценки кэшируются по хэшу раскладки.
+const float ESTIMATE_TICK = 1.0f / 120.0f;
+const int ESTIMATE_MAX_SECONDS = 900;
+// Шарик считается запертым, если столько секунд подряд не опускается ниже поля
+// блоков и ничего не разбивает: он ходит между непробиваемыми блоками
+const int ESTIMATE_TRAP_SECONDS = 20;
+// Как часто партия сверяется с бюджетом оценки
+const int ESTIMATE_BUDGET_CHECK_TICKS = 256;
+
+struct PlaythroughResult {
+    bool cleared;
+    bool trapped;
+    float playTime; // Секунд игры до конца партии
+    int ballsLost;
+};
+
+struct LevelEstimate {
+    int runs;
+    float clearRate;       // Доля пройденных партий
+    float medianClearTime; // Секунд, по пройденным партиям
+    float ballLossRate;    // Потерянных шариков в минуту игры
+    float trapRate;        // Доля партий, где шарик заперт непробиваемыми блоками
+};
+
+uint64_t layoutHash(const PackedLayout& layout) {
+    uint64_t hash = mixHash(static_cast<uint64_t>(layout.rows) << 32 | static_cast<uint32_t>(layout.cols));
+    for (int i = 0; i < layout.rows; i++)
+        hash = mixHash(hash ^ (static_cast<uint64_t>(layout.solid[i]) << 16 | layout.speedUp[i]));
+    return hash;
+}
+
+// Одна партия в текущем потоке. Состояние игры потока при этом затирается.
+// Исчерпанный budget обрывает партию, ее результат тогда не имеет смысла.
+PlaythroughResult playLayout(const PackedLayout& layout, uint32_t seed, const EstimateBudget* budget = nullptr) {
+    seedGameRandom(seed);
+    beginLevel(layout.rows, layout.cols);
+    applyLayout(layout);
+    resetPlayer();
+    // initGame их не сбрасывает, а партия не должна зависеть от предыдущей в потоке
+    stickyWait = 0;
+    oneTimeBottom = false;
+    reserveForLevel();
+    // Разные партии начинаются с разных мест платформы
+    paddle.x = static_cast<float>(gameRandom() % floorToInt(fieldWidth() - paddle.width));
+    balls[0].x = paddle.x + paddle.width / 2;
+
+    restartOnLevelEnd = false;
+    levelEnded = false;
+    ballSchedule.enabled = true;
+    const Real tick = ESTIMATE_TICK;
+    const Real fieldBottom = layout.rows * BLOCK_STEP_Y;
+    const int maxTicks = static_cast<int>(ESTIMATE_MAX_SECONDS / ESTIMATE_TICK);
+    const int trapTicks = static_cast<int>(ESTIMATE_TRAP_SECONDS / ESTIMATE_TICK);
+    PlaythroughResult result = { false, false, 0.0f, 0 };
+    int ticks = 0, ticksInField = 0;
+    while (!levelEnded && ticks < maxTicks && ticksInField < trapTicks) {
+        if (budget && ticks % ESTIMATE_BUDGET_CHECK_TICKS == 0 && budget->exceeded())
+            break;
+        const int livesBefore = lives, scoreBefore = score;
+        applyInput({ autopilotPaddleX(tick), true });
+        updateGame(tick);
+        ticks++;
+        if (lives < livesBefore)
+            result.ballsLost += livesBefore - lives;
+        bool inField = score == scoreBefore;
+        for (const auto& b : balls)
+            inField = inField && b.y - b.radius < fieldBottom;
+        ticksInField = inField ? ticksInField + 1 : 0;
+    }
+    restartOnLevelEnd = true;
+    ballSchedule.enabled = false;
+    result.cleared = isBoardCleared();
+    result.trapped = ticksInField >= trapTicks;
+    result.playTime = ticks * ESTIMATE_TICK;
+    return result;
+}
+
+std::unordered_map<uint64_t, LevelEstimate> estimateCache;
+std::mutex estimateCacheMutex;
+
+// Оценка, прерванная бюджетом, возвращается с runs = 0 и не кэшируется.
+LevelEstimate estimateLayout(const PackedLayout& layout, int runs, int numThreads = 0, const EstimateBudget* budget = nullptr) {
+    const uint64_t key = mixHash(layoutHash(layout) ^ static_cast<uint64_t>(runs));
+    {
+        std::lock_guard<std::mutex> lock(estimateCacheMutex);
+        auto cached = estimateCache.find(key);
+        if (cached != estimateCache.end())
+            return cached->second;
+    }
+
+    // Партии идут только в рабочих потоках: состояние вызывающего потока
+    // (например, идущий в главном потоке уровень) не трогается
+    if (numThreads <= 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    numThreads = std::min(numThreads, runs);
+    std::vector<PlaythroughResult> results(runs);
+    std::atomic<int> nextRun(0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < numThreads; t++) {
+        workers.emplace_back([&]() {
+            for (int run = nextRun++; run < runs; run = nextRun++)
+                results[run] = playLayout(layout, static_cast<uint32_t>(mixHash(key + run)), budget);
+        });
+    }
+    for (auto& worker : workers)
+        worker.join();
+
+    LevelEstimate estimate = { runs, 0.0f, 0.0f, 0.0f, 0.0f };
+    if (budget && budget->exceeded()) {
+        estimate.runs = 0;
+        return estimate;
+    }
+    std::vector<float> clearTimes;
+    float playTime = 0.0f;
+    int ballsLost = 0, trapped = 0;
+    for (const auto& result : results) {
+        if (result.cleared)
+            clearTimes.push_back(result.playTime);
+        playTime += result.playTime;
+        ballsLost += result.ballsLost;
+        trapped += result.trapped;
+    }
+    if (runs > 0) {
+        estimate.clearRate = static_cast<float>(clearTimes.size()) / runs;
+        estimate.trapRate = static_cast<float>(trapped) / runs;
+    }
+    if (!clearTimes.empty()) {
+        std::sort(clearTimes.begin(), clearTimes.end());
+        estimate.medianClearTime = clearTimes[clearTimes.size() / 2];
+    }
+    if (playTime > 0.0f)
+        estimate.ballLossRate = ballsLost * 60.0f / playTime;
+
+    std::lock_guard<std::mutex> lock(estimateCacheMutex);
+    estimateCache[key] = estimate;
+    return estimate;
 }
 
-void updateGame(float deltaTime) {
-    for (auto& ball : balls) {
-        // Обновление позиции шарика
-        if (checkCollision(ball, paddle) && stickyBall && ball.velocityX != 0 && ball.velocityY != 0) {
-            stickyWait++;
-            if (stickyWait > 8) {
-                stickyBall = false;
-                stickyWait = 0;
-            }
-            return;
-        }
-        else {
-            updateBall(ball, deltaTime);
-        }
+bool isAcceptedLayout(const PackedLayout& layout) {
+    const LevelEstimate estimate = estimateLayout(layout, levelFilter.runs, layoutSearch.estimateThreads, layoutSearch.budget);
+    // Бюджет исчерпан: дальше искать некогда, берется эта раскладка
+    if (estimate.runs < levelFilter.runs)
+        return true;
+    return estimate.clearRate >= levelFilter.minClearRate && estimate.medianClearTime >= levelFilter.minClearTime;
+}
 
-        // Обработка столкновений со стенами
-        if (ball.x < 0.0f || ball.x + ball.radius > WIDTH) {
-            ball.velocityX = -ball.velocityX;
-            updateBall(ball, deltaTime);
-        }
-        else if (ball.y < 0.0f) {
-            ball.velocityY = -ball.velocityY;
-            updateBall(ball, deltaTime);
-        }
+void renderAimAssist() {
+    glColor3f(0.4f, 0.8f, 0.4f);
+    glLineWidth(1);
+    for (int i = 0; i < static_cast<int>(balls.size()); i++) {
+        int segmentIndex;
+        const TrajectoryPrediction& path = predictTrajectory(i, segmentIndex);
+        if (path.numSegments == 0)
+            continue;
+        glBegin(GL_LINE_STRIP);
+        glVertex2f(toFloat(balls[i].x), toFloat(balls[i].y));
+        for (int j = segmentIndex; j < path.numSegments; j++)
+            glVertex2f(toFloat(path.segments[j].endX()), toFloat(path.segments[j].endY()));
+        glEnd();
+    }
+    glColor3f(1.0f, 1.0f, 1.0f);
+}
 
-        // Обработка столкновения с платформой
-        if (checkCollision(ball, paddle)) {
-            ball.velocityY = -ball.velocityY;
-            ball.y = paddle.y - ball.radius;
-        }
+// Рисуются только блоки в окне камеры: обход по сетке трогает только видимые чанки
+void renderBlocks() {
+    int rowBegin, rowEnd, colBegin, colEnd;
+    blockGrid.cellRange(camera.x, camera.y, camera.x + WIDTH, camera.y + HEIGHT, rowBegin, rowEnd, colBegin, colEnd);
+    blockGrid.forEachAlive(rowBegin, rowEnd, colBegin, colEnd, [](int row, int col) {
+        const Block block = blockGrid.block(row, col);
+        const float x = toFloat(block.x), y = toFloat(block.y);
+        const float width = toFloat(block.width), height = toFloat(block.height);
+        glColor3fv(blockTypeInfo(block.type).color);
 
-        // Обработка столкновений с блоками
-        for (auto& block : blocks) {
-            if (checkCollision(ball, block)) {
-                double xDist = std::abs(ball.x - (block.x + block.width / 2)) - block.width / 2;
-                double yDist = std::abs(ball.y - (block.y + block.height / 2)) - block.height / 2;
+        glBegin(GL_QUADS);
+        glVertex2f(x, y);
+        glVertex2f(x + width, y);
+        glVertex2f(x + width, y + height);
+        glVertex2f(x, y + height);
+        glEnd();
 
-                if (xDist < ball.radius && yDist < ball.radius) {
-                    if (xDist == yDist) {
-                        ball.velocityX = -ball.velocityX;
-                        ball.velocityY = -ball.velocityY;
-                    }
-                    else if (xDist < yDist) {
-                        ball.velocityY = -ball.velocityY;
-                    }
-                    else if (xDist > yDist) {
-                        ball.velocityX = -ball.velocityX;
-                    }
-                    updateBall(ball, deltaTime);
-                    destroy(block);
-                }
+        if (block.health > 0) {
+            glColor3f(0.0f, 0.0f, 0.0f);
+            glBegin(GL_LINES);
+            for (int i = 0; i < block.health; i++) {
+                glVertex2f(x + (i * (width / (block.health + 1))), y);
+                glVertex2f(x + (i * (width / (block.health + 1))), y + height);
             }
+            glEnd();
         }
+    });
+}
 
-        if (ball.y >= HEIGHT) {
-            if (oneTimeBottom) {
-                oneTimeBottom = false;
-                ball.velocityY = -ball.velocityY;
-            }
-            else if (balls.size() > 1) {
-                auto it = std::find(balls.begin(), balls.end(), ball);
-                if (it != balls.end()) {
-                    balls.erase(it);
-                }
-            }
-            else {
-                lives--;
-                if (lives <= 0) {
-                    std::cout << "Game Over! Your score: " << score << std::endl;
-                    initGame();
-                }
-                else {
-                    startFlag = true;
-                    stickyBall = true;
-                    ball.x = paddle.x + paddle.width / 2;
-                    ball.y = paddle.y - 10.0f;
-                    ball.velocityX = 0.0f;
-                    ball.velocityY = 0.0f;
-                }
-            }
-        }
-        if (isBoardCleared()) {
-            std::cout << "Game Over! Your score: " << score << std::endl;
-            initGame();
-        }
+// Сетки фигур считаются на этапе компиляции: в цикле отрисовки нет
+// тригонометрии, вершины только масштабируются и сдвигаются.
+struct Vertex2 {
+    float x, y;
+};
+
+template <int N>
+struct Mesh2 {
+    Vertex2 vertices[N];
+
+    static constexpr int size() {
+        return N;
+    }
+};
 
+// sin для constexpr: приведение к [-pi, pi] и ряд Тейлора
+constexpr double constexprSin(double x) {
+    const double twoPi = 2.0 * M_PI;
+    long long turns = static_cast<long long>(x / twoPi + (x >= 0 ? 0.5 : -0.5));
+    x -= turns * twoPi;
+    double term = x, sum = x;
+    for (int n = 1; n < 20; n++) {
+        term *= -x * x / ((2 * n) * (2 * n + 1));
+        sum += term;
     }
+    return sum;
+}
 
-    // Обновление бонусов
-    for (auto& bonus : bonuses) {
-        if (bonus.active) {
-            bonus.y += 100.0f * deltaTime;
+constexpr double constexprCos(double x) {
+    return constexprSin(x + M_PI / 2.0);
+}
 
-            if (checkCollision(paddle, bonus)) {
-                applyBonus(bonus.type);
-                bonus.active = false;
-            }
+// Единичная окружность из Segments отрезков, первая вершина повторяется в конце
+template <int Segments>
+constexpr Mesh2<Segments + 1> makeUnitCircle() {
+    Mesh2<Segments + 1> mesh = {};
+    for (int i = 0; i <= Segments; i++) {
+        const double angle = 2.0 * M_PI * i / Segments;
+        mesh.vertices[i].x = static_cast<float>(constexprCos(angle));
+        mesh.vertices[i].y = static_cast<float>(constexprSin(angle));
+    }
+    return mesh;
+}
 
-            if (bonus.y > HEIGHT) {
-                bonus.active = false;
-            }
-        }
+// Верхняя половина окружности радиуса 0.5 с центром (centerX, 0), обход слева
+// направо (direction = 1) или справа налево (direction = -1). Ось y направлена вниз.
+template <int Segments>
+constexpr Mesh2<Segments + 1> makeHalfCircle(double centerX, double direction) {
+    Mesh2<Segments + 1> mesh = {};
+    for (int i = 0; i <= Segments; i++) {
+        const double angle = M_PI * i / Segments;
+        mesh.vertices[i].x = static_cast<float>(centerX + direction * 0.5 * constexprCos(angle));
+        mesh.vertices[i].y = static_cast<float>(-0.5 * constexprSin(angle));
     }
+    return mesh;
 }
 
-void renderBlocks() {
-    for (const auto& block : blocks) {
-        if (!block.destroyed) {
-            auto it = blockColorMap.find(block.type);
-            if (it != blockColorMap.end()) {
-                glColor3f(std::get<0>(it->second), std::get<1>(it->second), std::get<2>(it->second));
-            }
+// Окружности нескольких уровней детализации
+constexpr Mesh2<17> unitCircle16 = makeUnitCircle<16>();
+constexpr Mesh2<33> unitCircle32 = makeUnitCircle<32>();
+constexpr Mesh2<65> unitCircle64 = makeUnitCircle<64>();
 
-            glBegin(GL_QUADS);
-            glVertex2f(block.x, block.y);
-            glVertex2f(block.x + block.width, block.y);
-            glVertex2f(block.x + block.width, block.y + block.height);
-            glVertex2f(block.x, block.y + block.height);
-            glEnd();
+static_assert(unitCircle32.vertices[8].x < 1e-6f && unitCircle32.vertices[8].y > 0.999999f, "constexpr trigonometry is off");
 
-            if (block.health > 0) {
-                glColor3f(0.0f, 0.0f, 0.0f);
-                glBegin(GL_LINES);
-                for (int i = 0; i < block.health; i++) {
-                    glVertex2f(block.x + (i * (block.width / (block.health + 1))), block.y);
-                    glVertex2f(block.x + (i * (block.width / (block.health + 1))), block.y + block.height);
-                }
-                glEnd();
-            }
-        }
-    }
+// Сердце в единицах половины размера: две полуокружности и треугольник
+constexpr Mesh2<21> heartLeftArc = makeHalfCircle<20>(-0.5, 1.0);
+constexpr Mesh2<21> heartRightArc = makeHalfCircle<20>(0.5, -1.0);
+constexpr Mesh2<3> heartBase = { { { -1.0f, 0.0f }, { 1.0f, 0.0f }, { 0.0f, 1.0f } } };
+
+// Рисует сетку с центром (x, y), увеличенную в scale раз
+template <int N>
+void emitMesh(const Mesh2<N>& mesh, float x, float y, float scale) {
+    for (int i = 0; i < N; i++)
+        glVertex2f(x + scale * mesh.vertices[i].x, y + scale * mesh.vertices[i].y);
+}
+
+// Окружность с числом сегментов по радиусу
+void emitCircle(float x, float y, float radius) {
+    if (radius <= 8.0f)
+        emitMesh(unitCircle16, x, y, radius);
+    else if (radius <= 24.0f)
+        emitMesh(unitCircle32, x, y, radius);
+    else
+        emitMesh(unitCircle64, x, y, radius);
 }
 
 // Объявляем функции для рисования объектов
@@ -521,16 +3675,13 @@ void drawHeart(float x, float y, float size);
 void drawCircle(float x, float y, float radius);
 void drawSquare(float x, float y, float size);
 
-// Создаем карту, которая сопоставляет типы бонусов с функциями рисования
-std::map<BonusType, std::function<void(float, float, float)>> bonusDrawFuncMap = {
-    {BONUS_SIZE_UP, drawPlus},
-    {BONUS_SIZE_DOWN, drawMinus},
-    {BONUS_SPEED_UP, drawPlus},
-    {BONUS_SPEED_DOWN, drawMinus},
-    {BONUS_STICKY, drawSquare},
-    {BONUS_EXTRA_LIFE, drawHeart},
-    {BONUS_EXTRA_BALL, drawCircle},
-    {BONUS_ONE_TIME_BOTTOM, drawHeart}
+// Функции рисования значков бонусов, индекс - BonusGlyph
+void (* const bonusGlyphFuncs[NUM_BONUS_GLYPHS])(float, float, float) = {
+    drawPlus,
+    drawMinus,
+    drawHeart,
+    drawCircle,
+    drawSquare
 };
 
 void drawPlus(float x, float y, float size) {
@@ -556,59 +3707,27 @@ void drawMinus(float x, float y, float size) {
 void drawHeart(float x, float y, float size) {
     glLineWidth(3);
     const float halfSize = size / 2.0f;
-    const float leftX = x - halfSize;
-    const float rightX = x + halfSize;
-    const float topY = y + halfSize;
 
     // Рисуем левую половину круга
     glBegin(GL_POLYGON);
-    const float leftCircleX = x - halfSize / 2.0f;
-    const float leftCircleY = y;
-    const float leftCircleRadius = halfSize / 2.0f;
-    const int numSegments = 20;
-    for (int i = 0; i <= numSegments; ++i) {
-        const float angle = M_PI * i / numSegments;
-        const float circleX = leftCircleX + leftCircleRadius * std::cos(angle);
-        const float circleY = leftCircleY - leftCircleRadius * std::sin(angle);
-        if (circleY <= y) {
-            glVertex2f(circleX, circleY);
-        }
-    }
+    emitMesh(heartLeftArc, x, y, halfSize);
     glEnd();
 
     // Рисуем правую половину круга
     glBegin(GL_POLYGON);
-    const float rightCircleX = x + halfSize / 2.0f;
-    const float rightCircleY = y;
-    const float rightCircleRadius = halfSize / 2.0f;
-    for (int i = 0; i <= numSegments; ++i) {
-        const float angle = M_PI * i / numSegments;
-        const float circleX = rightCircleX - rightCircleRadius * std::cos(angle);
-        const float circleY = rightCircleY - rightCircleRadius * std::sin(angle);
-        if (circleY <= y) {
-            glVertex2f(circleX, circleY);
-        }
-    }
+    emitMesh(heartRightArc, x, y, halfSize);
     glEnd();
 
     // Рисуем основание треугольника
     glBegin(GL_TRIANGLES);
-    glVertex2f(leftX, y);
-    glVertex2f(rightX, y);
-    glVertex2f(x, topY);
+    emitMesh(heartBase, x, y, halfSize);
     glEnd();
 }
 
 void drawCircle(float x, float y, float size) {
     glLineWidth(3);
     glBegin(GL_POLYGON);
-    const int numSegments = 30;
-    for (int i = 0; i <= numSegments; ++i) {
-        const float angle = 2.0f * M_PI * i / numSegments;
-        const float x1 = x + size / 2 * std::cos(angle);
-        const float y1 = y + size / 2 * std::sin(angle);
-        glVertex2f(x1, y1);
-    }
+    emitCircle(x, y, size / 2);
     glEnd();
 }
 
@@ -624,16 +3743,11 @@ void drawSquare(float x, float y, float size) {
 }
 
 void renderBonuses() {
-    for (const auto& bonus : bonuses) {
-        if (bonus.active) {
-            auto it = bonusColorMap.find(bonus.type);
-            if (it != bonusColorMap.end()) {
-                glColor3f(std::get<0>(it->second), std::get<1>(it->second), std::get<2>(it->second));
-            }
-
-            auto drawFunc = bonusDrawFuncMap[bonus.type];
-            drawFunc(bonus.x, bonus.y, std::max(bonus.width, bonus.height));
-        }
+    for (int i = 0; i < bonuses.size(); i++) {
+        const Bonus& bonus = bonuses[i];
+        const BonusTypeInfo& info = bonusTypeInfo(bonus.type);
+        glColor3fv(info.color);
+        bonusGlyphFuncs[info.glyph](toFloat(bonus.x), toFloat(bonus.y), toFloat(std::max(bonus.width, bonus.height)));
     }
 }
 
@@ -649,81 +3763,190 @@ void Line(float x, float y, float x1, float y1, float x2, float y2, float size)
     glVertex2f(x + x2 * size, y - y2 * size);
 }
 
+// Сегменты цифрового индикатора: верх, середина, низ, правый верх,
+// правый низ, левый верх, левый низ
+struct DigitSegment {
+    float x1, y1, x2, y2;
+};
+
+constexpr DigitSegment digitSegments[7] = {
+    { 0.3f, 0.85f, 0.7f, 0.85f },
+    { 0.3f, 0.5f, 0.7f, 0.5f },
+    { 0.3f, 0.15f, 0.7f, 0.15f },
+    { 0.7f, 0.5f, 0.7f, 0.85f },
+    { 0.7f, 0.5f, 0.7f, 0.15f },
+    { 0.3f, 0.5f, 0.3f, 0.85f },
+    { 0.3f, 0.5f, 0.3f, 0.15f },
+};
+
+// Маска горящих сегментов цифры (бит i - сегмент digitSegments[i])
+constexpr uint8_t digitSegmentMask(int a) {
+    return static_cast<uint8_t>(
+        ((a != 1 && a != 4) ? 1 << 0 : 0) |
+        ((a != 0 && a != 1 && a != 7) ? 1 << 1 : 0) |
+        ((a != 1 && a != 4 && a != 7) ? 1 << 2 : 0) |
+        ((a != 5 && a != 6) ? 1 << 3 : 0) |
+        ((a != 2) ? 1 << 4 : 0) |
+        ((a != 1 && a != 2 && a != 3 && a != 7) ? 1 << 5 : 0) |
+        ((a == 0 || a == 2 || a == 6 || a == 8) ? 1 << 6 : 0));
+}
+
+constexpr uint8_t digitSegmentMasks[10] = {
+    digitSegmentMask(0), digitSegmentMask(1), digitSegmentMask(2), digitSegmentMask(3), digitSegmentMask(4),
+    digitSegmentMask(5), digitSegmentMask(6), digitSegmentMask(7), digitSegmentMask(8), digitSegmentMask(9),
+};
+
+static_assert(digitSegmentMasks[8] == 0x7F, "digit 8 lights every segment");
+static_assert(digitSegmentMasks[1] == 0x18, "digit 1 lights only the right segments");
+
 void ShowCount(float x, float y, int a, float size) {
     glLineWidth(3);
     glBegin(GL_LINES);
-    if ((a != 1) && (a != 4)) Line(x, y, 0.3, 0.85, 0.7, 0.85, size);
-    if ((a != 0) && (a != 1) && (a != 7)) Line(x, y, 0.3, 0.5, 0.7, 0.5, size);
-    if ((a != 1) && (a != 4) && (a != 7)) Line(x, y, 0.3, 0.15, 0.7, 0.15, size);
-
-    if ((a != 5) && (a != 6)) Line(x, y, 0.7, 0.5, 0.7, 0.85, size);
-    if ((a != 2)) Line(x, y, 0.7, 0.5, 0.7, 0.15, size);
-
-    if ((a != 1) && (a != 2) && (a != 3) && (a != 7)) Line(x, y, 0.3, 0.5, 0.3, 0.85, size);
-    if ((a == 0) | (a == 2) || (a == 6) || (a == 8))   Line(x, y, 0.3, 0.5, 0.3, 0.15, size);
+    const uint8_t mask = digitSegmentMasks[a];
+    for (int i = 0; i < 7; i++) {
+        if (mask & (1 << i)) {
+            const DigitSegment& segment = digitSegments[i];
+            Line(x, y, segment.x1, segment.y1, segment.x2, segment.y2, size);
+        }
+    }
     glEnd();
 }
 
 void renderScore() {
     glColor3f(1.0f, 1.0f, 1.0f);
 
-    // Преобразуем текущий счет в строку
-    std::string st_score = std::to_string(score);
+    // Преобразуем текущий счет в строку в буфере на стеке, без выделения памяти
+    char st_score[16];
+    int length = std::snprintf(st_score, sizeof(st_score), "%d", score);
     // Рисуем цифры счета
-    for (int i = 0; i < st_score.length(); i++) { // Используем length() вместо size()
+    for (int i = 0; i < length; i++) {
         ShowCount(15.0f * i, 23.0f, st_score[i] - '0', 20.0f); // Вычитаем '0' из символа, чтобы получить его числовое значение
     }
 }
 
 // Render game objects
+// По горизонтали камера держит платформу в центре окна, по вертикали - самый
+// нижний шарик на нижней четверти окна (на поле высотой в окно она не двигается)
+void updateCamera() {
+    float lowest = toFloat(paddle.y);
+    if (!balls.empty()) {
+        lowest = toFloat(balls[0].y);
+        for (const auto& ball : balls)
+            lowest = std::max(lowest, toFloat(ball.y));
+    }
+    const float maxX = toFloat(fieldWidth()) - WIDTH, maxY = toFloat(fieldHeight()) - HEIGHT;
+    camera.x = std::max(0.0f, std::min(maxX, toFloat(paddle.x + paddle.width / 2) - WIDTH / 2.0f));
+    camera.y = std::max(0.0f, std::min(maxY, lowest - HEIGHT * 0.75f));
+}
+
 void renderGame() {
     glClear(GL_COLOR_BUFFER_BIT);
+    updateCamera();
+    glPushMatrix();
+    glTranslatef(-camera.x, -camera.y, 0.0f);
 
     // Render paddle
+    const float paddleX = toFloat(paddle.x), paddleY = toFloat(paddle.y);
     glBegin(GL_QUADS);
-    glVertex2f(paddle.x, paddle.y);
-    glVertex2f(paddle.x + paddle.width, paddle.y);
-    glVertex2f(paddle.x + paddle.width, paddle.y + paddle.height);
-    glVertex2f(paddle.x, paddle.y + paddle.height);
+    glVertex2f(paddleX, paddleY);
+    glVertex2f(paddleX + toFloat(paddle.width), paddleY);
+    glVertex2f(paddleX + toFloat(paddle.width), paddleY + toFloat(paddle.height));
+    glVertex2f(paddleX, paddleY + toFloat(paddle.height));
     glEnd();
 
     // Render balls
     for (const auto& ball : balls) {
         glBegin(GL_TRIANGLE_FAN);
-        for (int i = 0; i < 360; i++) {
-            float theta = i * 3.14159f / 180;
-            glVertex2f(ball.x + ball.radius * cos(theta), ball.y + ball.radius * sin(theta));
-        }
+        emitCircle(toFloat(ball.x), toFloat(ball.y), toFloat(ball.radius));
         glEnd();
     }
-
+    if (aimAssist)
+        renderAimAssist();
 
     renderBlocks();
     renderBonuses();
+    particles.render();
+    glPopMatrix();
+
+    // Жизни и счет - в координатах окна
     renderLives();
     renderScore();
 
     glColor3f(1.0f, 1.0f, 1.0f); // Reset color to white for next frame
 }
 
-int main() {
-    if (!glfwInit()) {
-        std::cerr << "Failed to initialize GLFW" << std::endl;
-        return -1;
+// Фазы кадра для отчета о выделениях памяти
+enum FramePhase {
+    PHASE_INPUT,
+    PHASE_UPDATE,
+    PHASE_RENDER,
+    PHASE_PRESENT,
+    NUM_FRAME_PHASES
+};
+
+#ifdef ARKANOID_TRACK_ALLOCATIONS
+const char* framePhaseNames[NUM_FRAME_PHASES] = { "input", "update", "render", "present" };
+long long phaseAllocations[NUM_FRAME_PHASES];
+long long phaseStartCount = 0;
+long long frameIndex = 0;
+long long steadyStateViolations = 0;
+int lastLevelLoads = 0;
+#endif
+
+// Фиксирует число выделений за только что завершившуюся фазу кадра
+void markPhaseEnd(FramePhase phase) {
+#ifdef ARKANOID_TRACK_ALLOCATIONS
+    long long count = threadAllocationCount;
+    phaseAllocations[phase] = count - phaseStartCount;
+    phaseStartCount = count;
+#else
+    (void)phase;
+#endif
+}
+
+// После загрузки уровня кадр не должен выделять память. Кадры, в которых
+// уровень загружался (initGame), в нарушения не засчитываются.
+void endFrameAllocations() {
+#ifdef ARKANOID_TRACK_ALLOCATIONS
+    long long total = 0;
+    for (int i = 0; i < NUM_FRAME_PHASES; i++)
+        total += phaseAllocations[i];
+
+    bool levelLoaded = levelLoads != lastLevelLoads;
+    lastLevelLoads = levelLoads;
+    if (total > 0 && !levelLoaded && frameIndex > 0) {
+        steadyStateViolations++;
+        std::cerr << "alloc frame " << frameIndex;
+        for (int i = 0; i < NUM_FRAME_PHASES; i++)
+            std::cerr << ' ' << framePhaseNames[i] << '=' << phaseAllocations[i];
+        std::cerr << std::endl;
     }
+    frameIndex++;
+#endif
+}
 
+void reportAllocations() {
+#ifdef ARKANOID_TRACK_ALLOCATIONS
+    std::cerr << "allocations: " << allocationCount.load() << " (" << allocationBytes.load() << " bytes), frames: "
+        << frameIndex << ", frames allocating in steady state: " << steadyStateViolations << std::endl;
+#endif
+}
+
+// Создание окна с контекстом OpenGL и ортографической проекцией под размер поля
+GLFWwindow* createGameWindow(bool visible) {
+    glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE);
     GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "Arkanoid", nullptr, nullptr);
     if (!window) {
         std::cerr << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return -1;
+        return nullptr;
     }
 
     glfwMakeContextCurrent(window);
 
     if (glewInit() != GLEW_OK) {
         std::cerr << "Failed to initialize GLEW" << std::endl;
-        return -1;
+        glfwDestroyWindow(window);
+        return nullptr;
     }
 
     glViewport(0, 0, WIDTH, HEIGHT);
@@ -732,23 +3955,671 @@ int main() {
     glOrtho(0, WIDTH, HEIGHT, 0, -1, 1);
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
+    return window;
+}
+
+// Бенчмарки горячего пути (Arkanoid.exe --bench).
+// Результаты печатаются в CSV: name,param,ops,ns_per_op,items_per_sec
+volatile int benchSink;
+
+// Операция повторяется пачками по opsPerBatch, перед каждой пачкой setup()
+// восстанавливает исходное состояние. Время setup() в замер не входит.
+template <typename Setup, typename Op>
+void runBenchmark(const char* name, long long param, double itemsPerOp, int opsPerBatch, Setup setup, Op op) {
+    using Clock = std::chrono::steady_clock;
+    Clock::duration elapsed = Clock::duration::zero();
+    long long ops = 0;
+    while (elapsed < std::chrono::milliseconds(200)) {
+        setup();
+        auto start = Clock::now();
+        for (int i = 0; i < opsPerBatch; i++)
+            op();
+        elapsed += Clock::now() - start;
+        ops += opsPerBatch;
+    }
+
+    double nsPerOp = std::chrono::duration<double, std::nano>(elapsed).count() / ops;
+    std::cout << name << ',' << param << ',' << ops << ',' << nsPerOp << ',' << itemsPerOp * 1e9 / nsPerOp << std::endl;
+}
+
+// Шарики раскладываются между нижним рядом блоков и платформой с запасом
+// на ticks тиков по 1/240 с: за это время они не долетают ни до блоков,
+// ни до платформы, поэтому состояние поля не меняется
+std::vector<Ball> makeBenchBalls(int count, int numRows, int ticks) {
+    std::vector<Ball> result;
+    result.reserve(count);
+    const float radius = 10.0f, speed = 200.0f;
+    const float reach = radius + speed * ticks / 240.0f;
+    const float blocksBottom = numRows * toFloat(BLOCK_STEP_Y);
+    const float paddleY = std::max(float(HEIGHT), blocksBottom + toFloat(FIELD_BOTTOM_MARGIN)) - 30.0f;
+    const int top = static_cast<int>(std::ceil(blocksBottom + reach));
+    const int span = std::max(1, static_cast<int>(paddleY - reach) - top);
+    for (int i = 0; i < count; i++) {
+        Ball b;
+        b.radius = radius;
+        b.x = 20.0f + gameRandom() % (WIDTH - 40);
+        b.y = static_cast<float>(top + gameRandom() % span);
+        b.velocityX = (gameRandom() % 2 == 0) ? speed : -speed;
+        b.velocityY = (gameRandom() % 2 == 0) ? speed : -speed;
+        result.push_back(b);
+    }
+    return result;
+}
+
+void resetBenchState() {
+    bonuses.clear();
+    tickCommands.clear();
+    score = 0;
+    lives = 3;
+    stickyWait = 0;
+    stickyBall = false;
+    startFlag = false;
+    oneTimeBottom = false;
+    bonusEffects.clear();
+}
+
+int runBenchmarks() {
+    // Генераторы меряются без отбора уровней
+    levelFilter.enabled = false;
+    seedSession(12345);
+    initGame();
+    resetBenchState();
+
+    std::cout << "name,param,ops,ns_per_op,items_per_sec" << std::endl;
+
+    // Проверки столкновений на заранее подготовленных парах
+    const int numPairs = 1024;
+    std::vector<Ball> pairBalls(numPairs);
+    std::vector<Block> pairBlocks(numPairs);
+    std::vector<Bonus> pairBonuses(numPairs);
+    for (int i = 0; i < numPairs; i++) {
+        pairBalls[i] = { static_cast<float>(gameRandom() % WIDTH), static_cast<float>(gameRandom() % HEIGHT), 10.0f, 200.0f, -200.0f };
+        pairBlocks[i] = { (gameRandom() % 10) * 80.0f, (gameRandom() % 20) * 30.0f, 78.0f, 28.0f, DESTRUCTIBLE, 1, false };
+        pairBonuses[i] = { static_cast<float>(gameRandom() % WIDTH), static_cast<float>(gameRandom() % HEIGHT), 20.0f, 20.0f, BONUS_SIZE_UP, true, -1 };
+    }
+    runBenchmark("checkCollision_ball_paddle", numPairs, numPairs, 64, [] {}, [&] {
+        int hits = 0;
+        for (auto& b : pairBalls)
+            hits += checkCollision(b, paddle);
+        benchSink = hits;
+    });
+    runBenchmark("checkCollision_ball_block", numPairs, numPairs, 64, [] {}, [&] {
+        int hits = 0;
+        for (int i = 0; i < numPairs; i++)
+            hits += checkCollision(pairBalls[i], pairBlocks[i]);
+        benchSink = hits;
+    });
+    runBenchmark("checkCollision_paddle_bonus", numPairs, numPairs, 64, [] {}, [&] {
+        int hits = 0;
+        for (auto& bonus : pairBonuses)
+            hits += checkCollision(paddle, bonus);
+        benchSink = hits;
+    });
+
+    // isBoardCleared в худшем случае: все блоки уже разбиты
+    for (int numRows : { 4, 10 }) {
+        runBenchmark("isBoardCleared", numRows * 10, numRows * 10, 1024, [&] {
+            beginLevel(numRows, FIELD_COLUMNS);
+            generateStripedField(numRows);
+            blockGrid.forEachAlive([](int row, int col) { blockGrid.setAlive(row, col, false); });
+        }, [] {
+            benchSink = isBoardCleared();
+        });
+    }
+
+    // Генераторы уровней
+    const std::pair<const char*, void (*)(int, int)> generators[] = {
+        { "generateSymmetricField", generateSymmetricField },
+        { "generatePatternedField", generatePatternedField },
+        { "generateStripedField", generateStripedField },
+    };
+    for (const auto& generator : generators) {
+        for (int numRows : { 4, 10 }) {
+            runBenchmark(generator.first, numRows, numRows * 10, 256, [] {}, [&] {
+                beginLevel(numRows, FIELD_COLUMNS);
+                generator.second(numRows, FIELD_COLUMNS);
+            });
+        }
+    }
+
+    // Битовые генераторы без записи в поле: раскладок в секунду
+    const std::pair<const char*, void (*)(int, int, PackedLayout&)> layoutGenerators[] = {
+        { "generateSymmetricLayout", generateSymmetricLayout },
+        { "generatePatternedLayout", generatePatternedLayout },
+        { "generateStripedLayout", generateStripedLayout },
+    };
+    for (const auto& generator : layoutGenerators) {
+        for (int numRows : { 4, 10 }) {
+            PackedLayout layout;
+            runBenchmark(generator.first, numRows, 1, 4096, [] {}, [&] {
+                generator.second(numRows, FIELD_COLUMNS, layout);
+                benchSink = layout.solid[0];
+            });
+        }
+    }
+
+    // Столкновения шариков: сортировка почти упорядоченного ballOrder и проход
+    for (int numBalls : { 10, 100, 1000, 10000 }) {
+        std::vector<Ball> startBalls = makeBenchBalls(numBalls, 10, 16);
+        runBenchmark("collideBalls", numBalls, numBalls, 16, [&] {
+            balls = startBalls;
+        }, [&] {
+            collideBalls();
+        });
+    }
+    // То же при постоянной плотности: квадрат со стороной 40 * sqrt(n), время на
+    // шарик не должно расти с их числом
+    for (int numBalls : { 1000, 10000, 100000 }) {
+        const int side = static_cast<int>(40.0 * std::sqrt(static_cast<double>(numBalls)));
+        std::vector<Ball> startBalls(numBalls);
+        for (auto& b : startBalls) {
+            b.radius = 10.0f;
+            b.x = static_cast<float>(gameRandom() % side);
+            b.y = static_cast<float>(gameRandom() % side);
+            b.velocityX = (gameRandom() % 2 == 0) ? 200.0f : -200.0f;
+            b.velocityY = (gameRandom() % 2 == 0) ? 200.0f : -200.0f;
+        }
+        runBenchmark("collideBalls_spread", numBalls, numBalls, 16, [&] {
+            balls = startBalls;
+        }, [&] {
+            collideBalls();
+        });
+    }
+
+    // updateGame: параметры - число шариков и число рядов блоков
+    const float benchDeltaTime = 1.0f / 240.0f;
+    for (int numRows : { 4, 10 }) {
+        for (int numBalls : { 1, 10, 100, 1000, 10000, 100000 }) {
+            std::vector<Ball> startBalls = makeBenchBalls(numBalls, numRows, 16);
+            std::string name = "updateGame_rows" + std::to_string(numRows);
+            runBenchmark(name.c_str(), numBalls, numBalls, 16, [&] {
+                beginLevel(numRows, FIELD_COLUMNS);
+                generateStripedField(numRows);
+                balls = startBalls;
+                resetBenchState();
+            }, [&] {
+                updateGame(benchDeltaTime);
+            });
+        }
+    }
+
+    // Предсказание пути до платформы: из кэша и с полным пересчетом
+    for (int numBalls : { 1, 100 }) {
+        std::vector<Ball> startBalls = makeBenchBalls(numBalls, 10, 16);
+        balls = startBalls;
+        reserveTrajectories();
+        // Кэш размерен под емкость balls, сбрасываются только шарики замера
+        auto setup = [&] {
+            beginLevel(10, FIELD_COLUMNS);
+            generateStripedField(10);
+            balls = startBalls;
+            resetBenchState();
+            std::fill_n(trajectoryCache.begin(), numBalls, TrajectoryPrediction());
+        };
+        runBenchmark("predictTrajectory_cached", numBalls, numBalls, 64, setup, [&] {
+            int segmentIndex, sum = 0;
+            for (int i = 0; i < numBalls; i++)
+                sum += predictTrajectory(i, segmentIndex).numSegments;
+            benchSink = sum;
+        });
+        TrajectoryPrediction path;
+        runBenchmark("computeTrajectory", numBalls, numBalls, 64, setup, [&] {
+            int sum = 0;
+            for (int i = 0; i < numBalls; i++) {
+                computeTrajectory(balls[i], path);
+                sum += path.numSegments;
+            }
+            benchSink = sum;
+        });
+    }
+
+    // Частицы: движение с удалением истекших. Пул включается только здесь, в
+    // конце, чтобы осколки не попадали в замеры updateGame выше.
+    particles.enable();
+    auto fillParticles = [](int numParticles) {
+        return [numParticles] {
+            particles.count = 0;
+            particles.emit(0.0f, 0.0f, WIDTH, HEIGHT, numParticles, SPARK_COLOR, 150.0f, 10.0f);
+        };
+    };
+    for (int numParticles : { 1000, PARTICLE_CAPACITY }) {
+        runBenchmark("particles_update", numParticles, numParticles, 16, fillParticles(numParticles), [] {
+            particles.update(1.0f / 240.0f);
+        });
+    }
+
+    // renderBlocks и частицы в невидимом окне
+    if (!glfwInit()) {
+        std::cerr << "Failed to initialize GLFW, skipping render benchmarks" << std::endl;
+        return 0;
+    }
+    GLFWwindow* window = createGameWindow(false);
+    if (window) {
+        for (int numRows : { 4, 10 }) {
+            beginLevel(numRows, FIELD_COLUMNS);
+            generateStripedField(numRows);
+            runBenchmark("renderBlocks", numRows * 10, numRows * 10, 64, [] {}, [] {
+                renderBlocks();
+                glFinish();
+            });
+        }
+        for (int numParticles : { 1000, PARTICLE_CAPACITY }) {
+            runBenchmark("particles_render", numParticles, numParticles, 64, fillParticles(numParticles), [] {
+                particles.render();
+                glFinish();
+            });
+        }
+        glfwDestroyWindow(window);
+    }
+    glfwTerminate();
+    return 0;
+}
+
+// Значение числового параметра командной строки вида "--name value"
+int intArg(int argc, char** argv, const char* name, int defaultValue) {
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::strcmp(argv[i], name) == 0)
+            return std::atoi(argv[i + 1]);
+    }
+    return defaultValue;
+}
+
+const char* stringArg(int argc, char** argv, const char* name) {
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::strcmp(argv[i], name) == 0)
+            return argv[i + 1];
+    }
+    return nullptr;
+}
+
+bool hasArg(int argc, char** argv, const char* name) {
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], name) == 0)
+            return true;
+    }
+    return false;
+}
+
+// Стресс-тест (Arkanoid.exe --stress [--rows R --cols C --balls B --bonuses N]).
+// Строит поле произвольного размера, добавляет шарики и бонусы и меряет
+// скорость симуляции и отрисовки. Без --rows/--cols прогоняет серию размеров поля
+// и серию количеств шариков. Вывод в CSV.
+const int STRESS_TICKS = 60;
+const int STRESS_ROWS = 10;
+
+void runStressCase(int numRows, int numCols, int numBalls, int numBonuses) {
+    using Clock = std::chrono::steady_clock;
+
+    seedGameRandom(12345);
+    beginLevel(numRows, numCols);
+    generateStripedField(numRows, numCols);
+    balls = makeBenchBalls(numBalls, numRows, STRESS_TICKS);
+    resetBenchState();
+    // Бонусов не больше емкости пула
+    for (int i = 0; i < numBonuses; i++) {
+        Bonus* bonus = bonuses.spawn();
+        if (!bonus)
+            break;
+        bonus->x = static_cast<float>(gameRandom() % (WIDTH - 20));
+        bonus->y = static_cast<float>(gameRandom() % (HEIGHT / 2));
+        bonus->width = 20.0f;
+        bonus->height = 20.0f;
+        bonus->type = randomBonusType();
+    }
+    const int spawnedBonuses = bonuses.size();
+    const double entities = static_cast<double>(blockGrid.aliveCount() + balls.size() + spawnedBonuses);
+
+    // Не больше STRESS_TICKS тиков по 1/240 с: шарики разложены с запасом на это время
+    const float deltaTime = 1.0f / 240.0f;
+    int ticks = 0;
+    auto start = Clock::now();
+    while (ticks < STRESS_TICKS && (ticks == 0 || Clock::now() - start < std::chrono::milliseconds(500))) {
+        updateGame(deltaTime);
+        ticks++;
+    }
+    double simNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / ticks;
+
+    int frames = 0;
+    start = Clock::now();
+    while (frames == 0 || Clock::now() - start < std::chrono::milliseconds(500)) {
+        renderGame();
+        glFinish();
+        frames++;
+    }
+    double renderNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / frames;
+
+    std::cout << numRows << ',' << numCols << ',' << numRows * numCols << ',' << numBalls << ',' << spawnedBonuses << ','
+        << ticks << ',' << simNs << ',' << entities * 1e9 / simNs << ','
+        << frames << ',' << renderNs << ',' << entities * 1e9 / renderNs << std::endl;
+}
+
+int runStressTest(int argc, char** argv) {
+    if (!glfwInit()) {
+        std::cerr << "Failed to initialize GLFW" << std::endl;
+        return -1;
+    }
+    GLFWwindow* window = createGameWindow(false);
+    if (!window) {
+        glfwTerminate();
+        return -1;
+    }
+    particles.enable();
+
+    levelFilter.enabled = false;
+    initGame();
+    const int numBalls = intArg(argc, argv, "--balls", 10);
+    const int numBonuses = intArg(argc, argv, "--bonuses", 100);
+
+    std::cout << "rows,cols,blocks,balls,bonuses,ticks,sim_ns_per_tick,sim_entities_per_sec,"
+        "frames,render_ns_per_frame,render_entities_per_sec" << std::endl;
+    if (hasArg(argc, argv, "--rows") || hasArg(argc, argv, "--cols")) {
+        runStressCase(intArg(argc, argv, "--rows", STRESS_ROWS), intArg(argc, argv, "--cols", FIELD_COLUMNS), numBalls, numBonuses);
+    }
+    else {
+        for (int side : { 10, 32, 100, 316, 1000 })
+            runStressCase(side, side, numBalls, numBonuses);
+        for (int ballCount : { 1, 10, 100, 1000, 10000 })
+            runStressCase(STRESS_ROWS, FIELD_COLUMNS, ballCount, numBonuses);
+    }
 
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return 0;
+}
+
+// Проверка записи (Arkanoid.exe --replay file): тики повторяются без окна, и
+// печатается первый тик, на котором состояние разошлось с записанным.
+int runReplayCheck(const char* path) {
+    Replay replay;
+    if (!loadReplay(replay, path))
+        return -1;
+    const int tick = firstDivergentTick(replayHashes(replay), playReplay(replay));
+    if (tick < 0) {
+        std::cout << "Replay matches: " << replay.frames.size() << " ticks" << std::endl;
+        return 0;
+    }
+    std::cout << "Replay diverges at tick " << tick << " of " << replay.frames.size() << std::endl;
+    return 1;
+}
+
+// Проверка снимка колеса эффектов (Arkanoid.exe --check-effects): колесо с
+// эффектами на всех уровнях и множителями без срока сохраняется, доигрывается
+// до конца, загружается из снимка и доигрывается снова. Хэш состояния после
+// загрузки и порядок истечения эффектов должны совпасть.
+int runEffectCheck() {
+    const uint32_t checkTicks = 300000;
+    seedSession(12345);
+    levelFilter.enabled = false;
+    initGame();
+    for (int i = 0; i < 1000; i++) {
+        const BonusType type = static_cast<BonusType>(gameRandom() % typeRegistry.numBonusTypes);
+        if (i % 100 == 0)
+            bonusEffects.addPermanent(type);
+        else
+            bonusEffects.schedule(1 + gameRandom() % 250000, type);
+        if (i % 10 == 0)
+            bonusEffects.tick([](BonusType) {});
+    }
+    applyEffectScales();
+
+    std::stringstream snapshot;
+    bonusEffects.save(snapshot);
+    const uint64_t savedHash = hashGameState();
+    auto expiries = [&] {
+        std::vector<uint64_t> order;
+        for (uint32_t tick = 0; tick < checkTicks; tick++) {
+            bonusEffects.tick([&](BonusType type) {
+                order.push_back(static_cast<uint64_t>(bonusEffects.now) << 8 | type);
+            });
+        }
+        return order;
+    };
+    const std::vector<uint64_t> expected = expiries();
+
+    if (!bonusEffects.load(snapshot)) {
+        std::cout << "Effect snapshot failed to load" << std::endl;
+        return 1;
+    }
+    if (hashGameState() != savedHash) {
+        std::cout << "Effect snapshot changes the state hash" << std::endl;
+        return 1;
+    }
+    const std::vector<uint64_t> actual = expiries();
+    if (actual != expected || bonusEffects.count != 0) {
+        std::cout << "Effect snapshot changes the expiry order" << std::endl;
+        return 1;
+    }
+    std::cout << "Effect snapshot matches: " << expected.size() << " expiries" << std::endl;
+    return 0;
+}
+
+// Проверка событийного режима (Arkanoid.exe --check-events [--games G]
+// [--balls N] [--seconds S]): G игр с автопилотом и N дополнительными шариками
+// идут обычными тиками и в событийном режиме, хэши состояния сравниваются на
+// каждом тике. Для сравнения печатается и время тика в обоих режимах.
+std::vector<uint64_t> playEventCheck(uint32_t seed, bool events, int extraBalls, int ticks, double& elapsedNs) {
+    using Clock = std::chrono::steady_clock;
+    const Real tick = ESTIMATE_TICK;
+    seedSession(seed);
+    initGame();
+    // initGame их не сбрасывает, а игра не должна зависеть от предыдущей
+    stickyWait = 0;
+    oneTimeBottom = false;
+    std::vector<Ball> extra = makeBenchBalls(extraBalls, blockGrid.rows, 0);
+    balls.insert(balls.end(), extra.begin(), extra.end());
+    reserveForLevel();
+    ballSchedule.enabled = events;
+    std::vector<uint64_t> hashes;
+    hashes.reserve(ticks);
+    const auto start = Clock::now();
+    for (int i = 0; i < ticks; i++) {
+        applyInput({ autopilotPaddleX(tick), true });
+        updateGame(tick);
+        hashes.push_back(hashGameState());
+    }
+    elapsedNs += std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    ballSchedule.enabled = false;
+    return hashes;
+}
+
+int runEventCheck(int argc, char** argv) {
+    levelFilter.enabled = false;
+    const int games = std::max(1, intArg(argc, argv, "--games", 4));
+    const int extraBalls = std::max(0, intArg(argc, argv, "--balls", 100));
+    const int ticks = static_cast<int>(std::max(1, intArg(argc, argv, "--seconds", 120)) / ESTIMATE_TICK + 0.5f);
+    double tickNs = 0.0, eventNs = 0.0;
+    for (int game = 0; game < games; game++) {
+        const uint32_t seed = static_cast<uint32_t>(mixHash(game));
+        const std::vector<uint64_t> expected = playEventCheck(seed, false, extraBalls, ticks, tickNs);
+        const std::vector<uint64_t> actual = playEventCheck(seed, true, extraBalls, ticks, eventNs);
+        const int tick = firstDivergentTick(expected, actual);
+        if (tick >= 0) {
+            std::cout << "Event mode diverges in game " << game << " at tick " << tick << " of " << ticks << std::endl;
+            return 1;
+        }
+    }
+    std::cout << "ticks: " << tickNs / (games * ticks) << " ns per tick, events: " << eventNs / (games * ticks) << " ns per tick" << std::endl;
+    std::cout << "Event mode matches: " << games << " games of " << ticks << " ticks" << std::endl;
+    return 0;
+}
+
+// Сравнение двух записей одной игры, сделанных разными сборками
+// (Arkanoid.exe --bisect a b): первый тик с разными хэшами
+int runReplayBisect(const char* pathA, const char* pathB) {
+    Replay a, b;
+    if (!loadReplay(a, pathA) || !loadReplay(b, pathB))
+        return -1;
+    const int tick = firstDivergentTick(replayHashes(a), replayHashes(b));
+    if (tick < 0) {
+        std::cout << "Hash streams match: " << a.frames.size() << " ticks" << std::endl;
+        return 0;
+    }
+    std::cout << "Hash streams diverge at tick " << tick << std::endl;
+    return 1;
+}
+
+// Оценка раскладок всех генераторов (Arkanoid.exe --estimate [--layouts N
+// --runs R --threads T]). Печатает CSV: показатели каждой раскладки и для
+// patterned - прошла ли она отбор levelFilter.
+int runEstimate(int argc, char** argv) {
+    using Clock = std::chrono::steady_clock;
+    typedef void (*LayoutGenerator)(int, int, PackedLayout&);
+    const struct {
+        const char* name;
+        LayoutGenerator generate;
+    } generators[] = {
+        { "symmetric", generateSymmetricLayout },
+        { "patterned", generatePatternedLayout },
+        { "striped", generateStripedLayout },
+    };
+    const int numLayouts = intArg(argc, argv, "--layouts", 4);
+    const int runs = intArg(argc, argv, "--runs", levelFilter.runs);
+    const int numThreads = intArg(argc, argv, "--threads", 0);
+
+    seedGameRandom(12345);
+    std::cout << "generator,layout,rows,clear_rate,median_clear_s,ball_loss_per_min,trap_rate,accepted,ms" << std::endl;
+    for (const auto& generator : generators) {
+        for (int i = 0; i < numLayouts; i++) {
+            PackedLayout layout;
+            generator.generate(4 + gameRandom() % (MAX_FIELD_ROWS - 3), FIELD_COLUMNS, layout);
+            const auto start = Clock::now();
+            const LevelEstimate estimate = estimateLayout(layout, runs, numThreads);
+            const double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            const bool accepted = estimate.clearRate >= levelFilter.minClearRate &&
+                estimate.medianClearTime >= levelFilter.minClearTime;
+            std::cout << generator.name << ',' << i << ',' << layout.rows << ',' << estimate.clearRate << ','
+                << estimate.medianClearTime << ',' << estimate.ballLossRate << ',' << estimate.trapRate << ','
+                << (accepted ? "yes" : "no") << ',' << ms << std::endl;
+        }
+    }
+    return 0;
+}
+
+// Запись набора уровней (Arkanoid.exe --make-pack file [--levels N]): N
+// случайных уровней размера levelSize (--rows, --cols), патерновые проходят
+// отбор levelFilter. Сетка записи - не меньше 16 x 16, чтобы в набор можно было
+// дописывать уровни до размера битовых раскладок. Формат - см. LevelPack.
+int runMakePack(const char* path, int argc, char** argv) {
+    const int numLevels = intArg(argc, argv, "--levels", 100);
+    const int gridRows = std::max(MAX_LAYOUT_ROWS, levelSize.rows > 0 ? levelSize.rows : MAX_FIELD_ROWS);
+    const int gridCols = std::max(MAX_LAYOUT_COLUMNS, levelSize.cols);
+    if (numLevels <= 0 || gridRows > UINT16_MAX || gridCols > UINT16_MAX) {
+        std::cerr << "Expected a positive level count and at most 65535 rows and columns" << std::endl;
+        return -1;
+    }
+    const LevelPackHeader header = { { LEVEL_PACK_MAGIC[0], LEVEL_PACK_MAGIC[1], LEVEL_PACK_MAGIC[2], LEVEL_PACK_MAGIC[3] },
+        LEVEL_PACK_VERSION, static_cast<uint32_t>(numLevels), static_cast<uint16_t>(gridRows), static_cast<uint16_t>(gridCols) };
+    const size_t gridBytes = static_cast<size_t>(header.gridRows) * header.gridCols;
+    const uint64_t firstGrid = sizeof(header) + numLevels * sizeof(LevelPackEntry);
+
+    std::vector<LevelPackEntry> index(numLevels);
+    std::vector<unsigned char> grids(numLevels * gridBytes, 0);
+    seedSession(12345);
+    for (int k = 0; k < numLevels; k++) {
+        generateLevel(static_cast<uint32_t>(gameRandom()));
+        index[k] = { firstGrid + k * gridBytes, static_cast<uint16_t>(blockGrid.rows), static_cast<uint16_t>(blockGrid.cols), 0 };
+        unsigned char* grid = &grids[k * gridBytes];
+        blockGrid.forEachAlive([&](int row, int col) {
+            grid[row * header.gridCols + col] = blockGrid.cell(row, col);
+        });
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(LevelPackEntry));
+    file.write(reinterpret_cast<const char*>(grids.data()), grids.size());
+    if (!file) {
+        std::cerr << "Failed to write level pack " << path << std::endl;
+        return -1;
+    }
+    std::cout << "Wrote " << numLevels << " levels to " << path << std::endl;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    loadTypeRegistry("types.cfg");
+    ballThreads = std::max(0, intArg(argc, argv, "--ball-threads", 0));
+
+    if (hasArg(argc, argv, "--bench"))
+        return runBenchmarks();
+    if (hasArg(argc, argv, "--stress"))
+        return runStressTest(argc, argv);
+    // Размер поля, в том числе для набора уровней и проверки записи
+    levelSize.rows = std::max(0, intArg(argc, argv, "--rows", 0));
+    levelSize.cols = std::max(1, intArg(argc, argv, "--cols", FIELD_COLUMNS));
+    if (const char* path = stringArg(argc, argv, "--make-pack"))
+        return runMakePack(path, argc, argv);
+    // Уровни по порядку из набора (--pack file) вместо случайных, в том числе
+    // при проверке записи: запись сделана с тем же набором
+    if (const char* path = stringArg(argc, argv, "--pack")) {
+        if (!levelPack.open(path))
+            return -1;
+    }
+    // Бесконечный режим, в том числе для проверки записи
+    endless.enabled = hasArg(argc, argv, "--endless");
+    if (const char* path = stringArg(argc, argv, "--replay"))
+        return runReplayCheck(path);
+    if (hasArg(argc, argv, "--estimate"))
+        return runEstimate(argc, argv);
+    if (hasArg(argc, argv, "--check-effects"))
+        return runEffectCheck();
+    if (hasArg(argc, argv, "--check-events"))
+        return runEventCheck(argc, argv);
+    for (int i = 1; i + 2 < argc; i++) {
+        if (std::strcmp(argv[i], "--bisect") == 0)
+            return runReplayBisect(argv[i + 1], argv[i + 2]);
+    }
+
+    if (!glfwInit()) {
+        std::cerr << "Failed to initialize GLFW" << std::endl;
+        return -1;
+    }
+
+    GLFWwindow* window = createGameWindow(true);
+    if (!window) {
+        glfwTerminate();
+        return -1;
+    }
+    particles.enable();
+
+    // Демонстрационный режим: играет автопилот
+    autopilot = hasArg(argc, argv, "--autopilot");
+    // Запись игры (--record file) сохраняется при выходе
+    const char* recordPath = stringArg(argc, argv, "--record");
+    Replay replay;
+    replay.seed = static_cast<uint32_t>(std::time(nullptr));
+    if (recordPath)
+        replay.frames.reserve(60 * 60 * 10);
+    seedSession(replay.seed);
     initGame();
 
     float lastTime = glfwGetTime();
+    markPhaseEnd(PHASE_PRESENT);
     while (!glfwWindowShouldClose(window)) {
         float currentTime = glfwGetTime();
         float deltaTime = currentTime - lastTime;
         lastTime = currentTime;
 
-        processInput(window, deltaTime);
-        updateGame(deltaTime);
+        const Real tickTime = deltaTime;
+        const PlayerInput input = processInput(window, deltaTime);
+        markPhaseEnd(PHASE_INPUT);
+        updateGame(tickTime);
+        if (recordPath)
+            replay.frames.push_back({ input.paddleX, input.launch, tickTime, hashGameState() });
+        markPhaseEnd(PHASE_UPDATE);
         renderGame();
+        markPhaseEnd(PHASE_RENDER);
 
         glfwSwapBuffers(window);
         glfwPollEvents();
+        markPhaseEnd(PHASE_PRESENT);
+        endFrameAllocations();
     }
 
+    reportAllocations();
     glfwTerminate();
+    replay.layoutAttempts = levelPreloader.attempts;
+    if (recordPath && !saveReplay(replay, recordPath))
+        return -1;
     return 0;
 }
\ No newline at end of file